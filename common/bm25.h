@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+// Okapi BM25 with the usual defaults. The indexer uses the same weight
+// function for the block-max bounds it stores (frequencies_codec.h), so the
+// parameters are fixed at indexing time.
+
+const double BM25_K1 = 1.2;
+const double BM25_B = 0.75;
+
+// Never negative, unlike the original Robertson-Sparck Jones idf.
+inline double bm25_idf(uint64_t doc_freq, uint64_t num_docs) {
+    return std::log(1.0 + (num_docs - doc_freq + 0.5) / (doc_freq + 0.5));
+}
+
+// The tf part of a term's score in a doc; the score is idf * weight.
+inline double bm25_tf_weight(uint32_t tf, uint32_t doc_length, double avg_doc_length) {
+    double norm = BM25_K1 * (1.0 - BM25_B + BM25_B * doc_length / avg_doc_length);
+    return tf * (BM25_K1 + 1.0) / (tf + norm);
+}
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// UTF-8 lowercasing shared by all labs. Works in place and never changes
+// the byte length, so callers can fold whole buffers or tokens that are
+// string_views into them.
+//
+// Folded: ASCII A-Z, Latin-1 (À..Þ), Latin Extended-A (Ā..ž), Cyrillic
+// А..Я, Ѐ..Џ (Ё, Є, І, Ї, Ў, ...) and Ґ and the other paired letters in
+// U+0480..U+04BF. Letters whose lowercase has another length (İ) are left
+// alone. With fold_yo, ё/Ё also become е.
+//
+// Every folded letter is a two-byte sequence, so a 64x32 table indexed by
+// (lead, continuation) covers them. Blocks holding only ASCII, Cyrillic
+// D0/D1 sequences and other non-folding bytes are handled 16 bytes at a
+// time with SSE2/NEON; blocks with other two-byte leads go through the table.
+
+struct CaseFoldTable {
+    // [lead - 0xC0][cont - 0x80] -> (new_lead << 8 | new_cont), 0 = unchanged.
+    // lead - 0xC0 is the code point >> 6, cont - 0x80 its low 6 bits.
+    uint16_t pair[32][64];
+};
+
+constexpr CaseFoldTable make_case_fold_table() {
+    CaseFoldTable t{};
+    auto set = [&t](unsigned cp_from, unsigned cp_to) {
+        t.pair[cp_from >> 6][cp_from & 0x3F] =
+            (uint16_t)(((0xC0 | (cp_to >> 6)) << 8) | (0x80 | (cp_to & 0x3F)));
+    };
+    for (unsigned cp = 0xC0; cp <= 0xDE; ++cp) {
+        if (cp != 0xD7) set(cp, cp + 0x20);
+    }
+    for (unsigned cp = 0x100; cp <= 0x137; cp += 2) {
+        if (cp != 0x130) set(cp, cp + 1);
+    }
+    for (unsigned cp = 0x139; cp <= 0x147; cp += 2) set(cp, cp + 1);
+    for (unsigned cp = 0x14A; cp <= 0x176; cp += 2) set(cp, cp + 1);
+    set(0x178, 0xFF);
+    for (unsigned cp = 0x179; cp <= 0x17D; cp += 2) set(cp, cp + 1);
+    for (unsigned cp = 0x400; cp <= 0x40F; ++cp) set(cp, cp + 0x50);
+    for (unsigned cp = 0x410; cp <= 0x42F; ++cp) set(cp, cp + 0x20);
+    set(0x480, 0x481);
+    for (unsigned cp = 0x48A; cp <= 0x4BE; cp += 2) set(cp, cp + 1);
+    return t;
+}
+
+inline constexpr CaseFoldTable CASE_FOLD_TABLE = make_case_fold_table();
+
+const unsigned char YO_LEAD = 0xD1, YO_CONT = 0x91;  // ё
+const unsigned char YE_LEAD = 0xD0, YE_CONT = 0xB5;  // е
+
+// Folds s[i..end) and returns the position after the last byte touched,
+// which is end + 1 when a sequence starts at end - 1.
+inline size_t fold_case_scalar(unsigned char* s, size_t i, size_t end, size_t len, bool fold_yo) {
+    while (i < end) {
+        unsigned char c = s[i];
+        if (c < 0x80) {
+            if (c >= 'A' && c <= 'Z') s[i] = c + 32;
+            ++i;
+            continue;
+        }
+        if (c >= 0xC0 && c < 0xE0 && i + 1 < len) {
+            unsigned char next = s[i + 1];
+            if ((next & 0xC0) == 0x80) {
+                uint16_t to = CASE_FOLD_TABLE.pair[c - 0xC0][next - 0x80];
+                if (to) {
+                    c = (unsigned char)(to >> 8);
+                    next = (unsigned char)to;
+                }
+                if (fold_yo && c == YO_LEAD && next == YO_CONT) {
+                    c = YE_LEAD;
+                    next = YE_CONT;
+                }
+                s[i] = c;
+                s[i + 1] = next;
+                i += 2;
+                continue;
+            }
+        }
+        ++i;
+    }
+    return i;
+}
+
+#if defined(__SSE2__)
+
+inline __m128i fold_in_range(__m128i x, unsigned char lo, unsigned char hi) {
+    __m128i ge = _mm_cmpeq_epi8(_mm_max_epu8(x, _mm_set1_epi8((char)lo)), x);
+    __m128i le = _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8((char)hi)), x);
+    return _mm_and_si128(ge, le);
+}
+
+// Folds the 16 bytes at s + i. Sequences starting in bytes 0..14 are
+// complete inside the block; a lead in byte 15 is left for the next block.
+inline size_t fold_case_block(unsigned char* s, size_t i, size_t len, bool fold_yo) {
+    __m128i b = _mm_loadu_si128((const __m128i*)(s + i));
+    __m128i upper = _mm_and_si128(fold_in_range(b, 'A', 'Z'), _mm_set1_epi8(0x20));
+
+    if (_mm_movemask_epi8(b) == 0) {
+        _mm_storeu_si128((__m128i*)(s + i), _mm_add_epi8(b, upper));
+        return i + 16;
+    }
+
+    __m128i first15 = _mm_srli_si128(_mm_set1_epi8(-1), 1);
+    __m128i lead0 = _mm_and_si128(_mm_cmpeq_epi8(b, _mm_set1_epi8((char)0xD0)), first15);
+    __m128i lead1 = _mm_and_si128(_mm_cmpeq_epi8(b, _mm_set1_epi8((char)0xD1)), first15);
+    __m128i other = _mm_andnot_si128(_mm_or_si128(lead0, lead1),
+                                     _mm_and_si128(fold_in_range(b, 0xC0, 0xDF), first15));
+    if (_mm_movemask_epi8(other) != 0) {
+        return fold_case_scalar(s, i, i + 16, len, fold_yo);
+    }
+
+    __m128i after0 = _mm_slli_si128(lead0, 1);
+    __m128i r8 = _mm_and_si128(after0, fold_in_range(b, 0x80, 0x8F));
+    __m128i r9 = _mm_and_si128(after0, fold_in_range(b, 0x90, 0x9F));
+    __m128i ra = _mm_and_si128(after0, fold_in_range(b, 0xA0, 0xAF));
+    __m128i to_d1 = _mm_or_si128(r8, ra);
+    __m128i to_d0 = _mm_setzero_si128();
+    __m128i yo = _mm_setzero_si128();
+    if (fold_yo) {
+        __m128i after1 = _mm_slli_si128(lead1, 1);
+        __m128i yo0 = _mm_and_si128(after0, _mm_cmpeq_epi8(b, _mm_set1_epi8((char)0x81)));
+        __m128i yo1 = _mm_and_si128(after1, _mm_cmpeq_epi8(b, _mm_set1_epi8((char)YO_CONT)));
+        yo = _mm_or_si128(yo0, yo1);
+        to_d1 = _mm_andnot_si128(yo0, to_d1);
+        to_d0 = yo1;
+    }
+
+    __m128i delta = upper;
+    delta = _mm_or_si128(delta, _mm_and_si128(r8, _mm_set1_epi8(0x10)));
+    delta = _mm_or_si128(delta, _mm_and_si128(r9, _mm_set1_epi8(0x20)));
+    delta = _mm_or_si128(delta, _mm_and_si128(ra, _mm_set1_epi8((char)0xE0)));
+    delta = _mm_or_si128(delta, _mm_and_si128(_mm_srli_si128(to_d1, 1), _mm_set1_epi8(1)));
+    delta = _mm_or_si128(delta, _mm_srli_si128(to_d0, 1));
+    __m128i out = _mm_add_epi8(b, delta);
+    out = _mm_or_si128(_mm_andnot_si128(yo, out), _mm_and_si128(yo, _mm_set1_epi8((char)YE_CONT)));
+    _mm_storeu_si128((__m128i*)(s + i), out);
+
+    return s[i + 15] >= 0xC0 ? i + 15 : i + 16;
+}
+
+#elif defined(__ARM_NEON)
+
+inline uint8x16_t fold_in_range(uint8x16_t x, unsigned char lo, unsigned char hi) {
+    return vandq_u8(vcgeq_u8(x, vdupq_n_u8(lo)), vcleq_u8(x, vdupq_n_u8(hi)));
+}
+
+inline size_t fold_case_block(unsigned char* s, size_t i, size_t len, bool fold_yo) {
+    uint8x16_t b = vld1q_u8(s + i);
+    uint8x16_t upper = vandq_u8(fold_in_range(b, 'A', 'Z'), vdupq_n_u8(0x20));
+
+    if (vmaxvq_u8(b) < 0x80) {
+        vst1q_u8(s + i, vaddq_u8(b, upper));
+        return i + 16;
+    }
+
+    uint8x16_t zero = vdupq_n_u8(0);
+    uint8x16_t first15 = vextq_u8(vdupq_n_u8(0xFF), zero, 1);
+    uint8x16_t lead0 = vandq_u8(vceqq_u8(b, vdupq_n_u8(0xD0)), first15);
+    uint8x16_t lead1 = vandq_u8(vceqq_u8(b, vdupq_n_u8(0xD1)), first15);
+    uint8x16_t other = vbicq_u8(vandq_u8(fold_in_range(b, 0xC0, 0xDF), first15), vorrq_u8(lead0, lead1));
+    if (vmaxvq_u8(other) != 0) {
+        return fold_case_scalar(s, i, i + 16, len, fold_yo);
+    }
+
+    uint8x16_t after0 = vextq_u8(zero, lead0, 15);
+    uint8x16_t r8 = vandq_u8(after0, fold_in_range(b, 0x80, 0x8F));
+    uint8x16_t r9 = vandq_u8(after0, fold_in_range(b, 0x90, 0x9F));
+    uint8x16_t ra = vandq_u8(after0, fold_in_range(b, 0xA0, 0xAF));
+    uint8x16_t to_d1 = vorrq_u8(r8, ra);
+    uint8x16_t to_d0 = zero;
+    uint8x16_t yo = zero;
+    if (fold_yo) {
+        uint8x16_t after1 = vextq_u8(zero, lead1, 15);
+        uint8x16_t yo0 = vandq_u8(after0, vceqq_u8(b, vdupq_n_u8(0x81)));
+        uint8x16_t yo1 = vandq_u8(after1, vceqq_u8(b, vdupq_n_u8(YO_CONT)));
+        yo = vorrq_u8(yo0, yo1);
+        to_d1 = vbicq_u8(to_d1, yo0);
+        to_d0 = yo1;
+    }
+
+    uint8x16_t delta = upper;
+    delta = vorrq_u8(delta, vandq_u8(r8, vdupq_n_u8(0x10)));
+    delta = vorrq_u8(delta, vandq_u8(r9, vdupq_n_u8(0x20)));
+    delta = vorrq_u8(delta, vandq_u8(ra, vdupq_n_u8(0xE0)));
+    delta = vorrq_u8(delta, vandq_u8(vextq_u8(to_d1, zero, 1), vdupq_n_u8(1)));
+    delta = vorrq_u8(delta, vextq_u8(to_d0, zero, 1));
+    uint8x16_t out = vaddq_u8(b, delta);
+    out = vbslq_u8(yo, vdupq_n_u8(YE_CONT), out);
+    vst1q_u8(s + i, out);
+
+    return s[i + 15] >= 0xC0 ? i + 15 : i + 16;
+}
+
+#endif
+
+inline void fold_case(char* data, size_t len, bool fold_yo = false) {
+    unsigned char* s = reinterpret_cast<unsigned char*>(data);
+    size_t i = 0;
+#if defined(__SSE2__) || defined(__ARM_NEON)
+    while (i + 16 <= len) {
+        i = fold_case_block(s, i, len, fold_yo);
+    }
+#endif
+    fold_case_scalar(s, i, len, len, fold_yo);
+}
+
+inline void to_lower_string(std::string& str, bool fold_yo = false) {
+    fold_case(&str[0], str.size(), fold_yo);
+}
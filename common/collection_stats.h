@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+
+// Layout of index_stats.bin, written by the indexer next to index.bin:
+//
+//   StatsHeader
+//   TermStat[num_terms]                by descending collection frequency
+//   strings blob                       term bytes, referenced by TermStat::term_offset
+//   HeapsPoint[num_heaps_points]       vocabulary size after `tokens` tokens
+//   uint64_t[num_doc_length_buckets]   docs with floor(log2(tokens + 1)) == b
+//   uint64_t[num_postings_buckets]     terms with floor(log2(doc_freq)) == b
+//
+// Sections start at 8-byte aligned offsets, like index.bin. Everything is
+// little-endian; lab4_plot.py reads it directly.
+
+const uint32_t STATS_MAGIC = 0x41545350; // "PSTA"
+const uint32_t STATS_VERSION = 1;
+const uint32_t STATS_HIST_BUCKETS = 32;
+
+struct StatsHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_docs;
+    uint32_t num_terms;
+    uint64_t total_tokens;
+    uint64_t strings_size;
+    uint32_t num_heaps_points;
+    uint32_t num_doc_length_buckets;
+    uint32_t num_postings_buckets;
+    uint32_t reserved;
+};
+
+struct TermStat {
+    uint64_t coll_freq;
+    uint32_t doc_freq;
+    uint32_t term_offset;
+    uint32_t term_len;
+    uint32_t reserved;
+};
+
+struct HeapsPoint {
+    uint64_t tokens;
+    uint64_t vocab;
+};
+
+static_assert(sizeof(StatsHeader) == 48, "StatsHeader layout changed");
+static_assert(sizeof(TermStat) == 24, "TermStat layout changed");
+
+inline uint32_t log2_bucket(uint64_t v) {
+    uint32_t b = 0;
+    while (v > 1 && b + 1 < STATS_HIST_BUCKETS) {
+        v >>= 1;
+        b++;
+    }
+    return b;
+}
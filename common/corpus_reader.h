@@ -0,0 +1,200 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mapped_file.h"
+
+// One corpus line: id \t url \t title \t text. Lines without the text
+// column keep everything after the url in title and body, with text empty.
+// body is "title \t text", the span the tools tokenize as one piece.
+struct CorpusDoc {
+    std::string_view id;
+    std::string_view url;
+    std::string_view title;
+    std::string_view text;
+    std::string_view body;
+    bool has_text = false;
+};
+
+inline bool parse_corpus_line(std::string_view line, CorpusDoc& doc) {
+    const char* begin = line.data();
+    const char* end = begin + line.size();
+
+    const char* tab1 = (const char*)memchr(begin, '\t', end - begin);
+    if (!tab1) return false;
+    const char* tab2 = (const char*)memchr(tab1 + 1, '\t', end - tab1 - 1);
+    if (!tab2) return false;
+    const char* tab3 = (const char*)memchr(tab2 + 1, '\t', end - tab2 - 1);
+
+    doc.id = std::string_view(begin, tab1 - begin);
+    doc.url = std::string_view(tab1 + 1, tab2 - tab1 - 1);
+    doc.body = std::string_view(tab2 + 1, end - tab2 - 1);
+    doc.has_text = tab3 != nullptr;
+    if (tab3) {
+        doc.title = std::string_view(tab2 + 1, tab3 - tab2 - 1);
+        doc.text = std::string_view(tab3 + 1, end - tab3 - 1);
+    } else {
+        doc.title = doc.body;
+        doc.text = std::string_view();
+    }
+    return true;
+}
+
+// Reads the corpus without copying it: regular files are mmapped and every
+// line, block and field handed out is a view into the mapping, valid for the
+// reader's lifetime. Pipes and other unmappable inputs are streamed through
+// an internal buffer instead; then a view is only valid until the next call.
+class CorpusReader {
+private:
+    static const size_t READ_BLOCK = 1 << 20;
+
+    MappedFile map;
+    int fd = -1;
+    std::string buf;
+    size_t pos = 0;
+    size_t range_end = SIZE_MAX;
+    bool eof = true;
+
+    const char* base() const { return map.is_open() ? map.data() : buf.data(); }
+    size_t limit() const { return map.is_open() ? std::min(map.size(), range_end) : buf.size(); }
+    size_t avail() const { return limit() - pos; }
+
+    // Streaming only: drops consumed bytes and reads until at least `need`
+    // unread bytes are buffered or the input ends.
+    void fill(size_t need) {
+        if (eof) return;
+        if (pos > 0) {
+            buf.erase(0, pos);
+            pos = 0;
+        }
+        while (buf.size() < need && !eof) {
+            size_t old = buf.size();
+            buf.resize(old + READ_BLOCK);
+            ssize_t got = ::read(fd, &buf[old], READ_BLOCK);
+            if (got < 0 && errno == EINTR) got = 0;
+            else if (got <= 0) eof = true;
+            buf.resize(old + (got > 0 ? got : 0));
+        }
+    }
+
+    // First line start at or after `offset` in the mapping.
+    size_t line_start(size_t offset) const {
+        if (offset == 0) return 0;
+        if (offset >= map.size()) return map.size();
+        const char* nl = (const char*)memchr(map.data() + offset - 1, '\n', map.size() - offset + 1);
+        return nl ? nl - map.data() + 1 : map.size();
+    }
+
+    std::string_view take(size_t len, size_t skip) {
+        std::string_view out(base() + pos, len);
+        pos += len + skip;
+        return out;
+    }
+
+public:
+    CorpusReader() = default;
+    CorpusReader(const CorpusReader&) = delete;
+    CorpusReader& operator=(const CorpusReader&) = delete;
+
+    ~CorpusReader() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+        int in = path == "-" ? dup(STDIN_FILENO) : ::open(path.c_str(), O_RDONLY);
+        if (in < 0) return false;
+
+        struct stat st;
+        if (fstat(in, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && map.open(path)) {
+            ::close(in);
+            madvise(const_cast<char*>(map.data()), map.size(), MADV_SEQUENTIAL);
+            return true;
+        }
+
+        fd = in;
+        eof = false;
+        return true;
+    }
+
+    void close() {
+        map.close();
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+        buf.clear();
+        pos = 0;
+        range_end = SIZE_MAX;
+        eof = true;
+    }
+
+    bool is_mapped() const { return map.is_open(); }
+    size_t mapped_size() const { return map.is_open() ? map.size() : 0; }
+
+    // Mapped files only: limits the reader to the lines that start in
+    // [begin, end). Adjacent ranges split the lines between them exactly,
+    // which is how the indexer cuts the corpus into shards.
+    bool set_range(size_t begin, size_t end) {
+        if (!map.is_open()) return false;
+        pos = line_start(begin);
+        range_end = line_start(end);
+        return true;
+    }
+
+    // Next line without its '\n'.
+    bool next_line(std::string_view& line) {
+        size_t scanned = 0;
+        while (true) {
+            const char* start = base() + pos;
+            const char* nl = (const char*)memchr(start + scanned, '\n', avail() - scanned);
+            if (nl) {
+                line = take(nl - start, 1);
+                return true;
+            }
+            if (eof) {
+                if (avail() == 0) return false;
+                line = take(avail(), 0);
+                return true;
+            }
+            scanned = avail();
+            fill(avail() + READ_BLOCK);
+        }
+    }
+
+    // Next non-empty line that has at least the id, url and title columns.
+    bool next(CorpusDoc& doc) {
+        std::string_view line;
+        while (next_line(line)) {
+            if (!line.empty() && parse_corpus_line(line, doc)) return true;
+        }
+        return false;
+    }
+
+    // About `target` bytes of whole lines, extended to the end of the last
+    // line (the final '\n' is included when present).
+    bool next_block(size_t target, std::string_view& block) {
+        fill(target);
+        if (avail() == 0) return false;
+
+        size_t scanned = std::min(target, avail()) - 1;
+        while (true) {
+            const char* start = base() + pos;
+            const char* nl = (const char*)memchr(start + scanned, '\n', avail() - scanned);
+            if (nl) {
+                block = take(nl - start + 1, 0);
+                return true;
+            }
+            if (eof) {
+                block = take(avail(), 0);
+                return true;
+            }
+            scanned = avail();
+            fill(avail() + READ_BLOCK);
+        }
+    }
+};
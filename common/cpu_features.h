@@ -0,0 +1,23 @@
+#pragma once
+
+// Run-time CPU checks for SIMD code built for a newer instruction set than
+// the rest of the program. With GCC or Clang on x86 the AVX2 paths are
+// always compiled (target attribute), whatever -m flags the build uses, and
+// taken only when cpu_has_avx2() says so; a build with -mavx2 calls them
+// directly.
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_AVX2_TARGET 1
+#include <immintrin.h>
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+inline bool cpu_has_avx2() {
+#if defined(__AVX2__)
+    return true;
+#else
+    static const bool has = __builtin_cpu_supports("avx2");
+    return has;
+#endif
+}
+#endif
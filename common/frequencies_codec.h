@@ -0,0 +1,193 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "bm25.h"
+#include "postings_codec.h"
+
+// Term frequency lists for ranked retrieval. They repeat the doc ids next to
+// the tfs, like the positions lists, so a ranked query reads one list per
+// term whatever codec its boolean postings use. Layout of one term's list:
+//
+//   float      max_weight        max of the blocks' max_weight
+//   uint32_t   reserved
+//   FreqBlock[num_blocks(doc_freq)]
+//   blocks     doc gaps as a BP128 block (postings_codec.h), then the tfs:
+//              a width byte and 128 bit-packed values for a full block,
+//              vbyte values for the last partial one
+//
+// FreqBlock::max_weight bounds bm25_tf_weight() over the block's docs, so
+// Block-Max WAND can skip blocks that cannot reach the top k without
+// decoding them.
+
+struct FreqBlock {
+    uint32_t last_doc;
+    uint32_t offset; // from the start of the blocks
+    float max_weight;
+};
+
+static_assert(sizeof(FreqBlock) == 12, "FreqBlock layout changed");
+
+const size_t FREQ_LIST_HEADER = 8;
+
+inline void encode_values(const uint32_t* vals, uint32_t count, std::vector<char>& out) {
+    if (count == BP128_BLOCK) {
+        uint32_t max_val = 0;
+        for (uint32_t j = 0; j < count; ++j) max_val |= vals[j];
+        uint32_t width = bit_width(max_val);
+        out.push_back((char)width);
+        bp128_pack(out, vals, width);
+        return;
+    }
+    for (uint32_t j = 0; j < count; ++j) vbyte_put(out, vals[j]);
+}
+
+inline const uint8_t* decode_values(const uint8_t* in, uint32_t count, uint32_t* out) {
+    if (count == BP128_BLOCK) {
+        uint32_t width = *in++;
+        return bp128_unpack(in, width, out);
+    }
+    for (uint32_t j = 0; j < count; ++j) in = vbyte_get(in, out[j]);
+    return in;
+}
+
+// The stored bounds are rounded up to the next float, so they never fall
+// below a weight the searcher computes in double precision.
+inline void encode_frequencies(const uint32_t* docs, const uint32_t* tfs, size_t n, const uint32_t* doc_lengths,
+                               double avg_doc_length, std::vector<char>& out) {
+    uint32_t blocks = num_blocks((uint32_t)n);
+    size_t header_pos = out.size();
+    out.resize(out.size() + FREQ_LIST_HEADER + (size_t)blocks * sizeof(FreqBlock));
+    size_t data_pos = out.size();
+
+    float list_max = 0;
+    uint32_t prev = 0;
+    for (uint32_t b = 0; b < blocks; ++b) {
+        uint32_t first = b * BP128_BLOCK;
+        uint32_t count = std::min<uint32_t>(BP128_BLOCK, (uint32_t)n - first);
+
+        double weight = 0;
+        for (uint32_t j = first; j < first + count; ++j) {
+            weight = std::max(weight, bm25_tf_weight(tfs[j], doc_lengths[docs[j]], avg_doc_length));
+        }
+        FreqBlock block{docs[first + count - 1], (uint32_t)(out.size() - data_pos),
+                        std::nextafter((float)weight, INFINITY)};
+        list_max = std::max(list_max, block.max_weight);
+
+        encode_block(docs + first, count, prev, CODEC_BP128, out);
+        encode_values(tfs + first, count, out);
+        prev = block.last_doc;
+
+        memcpy(out.data() + header_pos + FREQ_LIST_HEADER + b * sizeof(FreqBlock), &block, sizeof(block));
+    }
+    memcpy(out.data() + header_pos, &list_max, sizeof(list_max));
+}
+
+// Forward-only cursor over a frequency list. Doc ids of a block are decoded
+// when the cursor enters it, its tfs only when tf() is first asked for.
+// shallow_advance() only moves the block-max view, decoding nothing.
+class FreqCursor {
+private:
+    const char* data = nullptr;
+    const uint8_t* blocks = nullptr;
+    uint32_t n = 0;
+    uint32_t total_blocks = 0;
+
+    uint32_t pos = 0;
+    uint32_t block_no = UINT32_MAX;
+    uint32_t block_first = 0;
+    uint32_t block_count = 0;
+    const uint8_t* tfs_in = nullptr;
+    bool tfs_loaded = false;
+    uint32_t docs[BP128_BLOCK];
+    uint32_t tfs[BP128_BLOCK];
+
+    uint32_t shallow_no = 0;
+
+public:
+    FreqCursor() = default;
+
+    FreqCursor(const char* list, uint32_t doc_freq) : data(list), n(doc_freq), total_blocks(num_blocks(doc_freq)) {
+        blocks = (const uint8_t*)data + FREQ_LIST_HEADER + (size_t)total_blocks * sizeof(FreqBlock);
+        if (n > 0) load_block(0);
+    }
+
+    uint32_t size() const { return n; }
+    bool at_end() const { return pos >= n; }
+    uint32_t doc() const { return docs[pos - block_first]; }
+
+    uint32_t tf() {
+        if (!tfs_loaded) {
+            decode_values(tfs_in, block_count, tfs);
+            tfs_loaded = true;
+        }
+        return tfs[pos - block_first];
+    }
+
+    float max_weight() const {
+        float w;
+        memcpy(&w, data, sizeof(w));
+        return w;
+    }
+
+    void next() {
+        if (++pos < n && pos >= block_first + block_count) load_block(block_no + 1);
+    }
+
+    void advance(uint32_t target) {
+        if (at_end() || doc() >= target) return;
+        if (docs[block_count - 1] < target) {
+            shallow_advance(target);
+            if (shallow_no == total_blocks) {
+                pos = n;
+                return;
+            }
+            load_block(shallow_no);
+        }
+        uint32_t* it = std::lower_bound(docs + (pos - block_first), docs + block_count, target);
+        pos = block_first + (uint32_t)(it - docs);
+    }
+
+    // Points the block-max view at the block that would hold `target`
+    // (target >= doc()); false past the last block.
+    bool shallow_advance(uint32_t target) {
+        if (shallow_no < block_no) shallow_no = block_no;
+        if (shallow_no < total_blocks && block_at(shallow_no).last_doc < target) {
+            uint32_t lo = shallow_no + 1, hi = total_blocks;
+            while (lo < hi) {
+                uint32_t mid = lo + (hi - lo) / 2;
+                if (block_at(mid).last_doc < target) lo = mid + 1;
+                else hi = mid;
+            }
+            shallow_no = lo;
+        }
+        return shallow_no < total_blocks;
+    }
+
+    // After a shallow_advance() that returned false there is no block to
+    // read the bounds of.
+    bool shallow_past_end() const { return shallow_no >= total_blocks; }
+    float shallow_max_weight() const { return block_at(shallow_no).max_weight; }
+    uint32_t shallow_last_doc() const { return block_at(shallow_no).last_doc; }
+
+private:
+    FreqBlock block_at(uint32_t b) const {
+        FreqBlock e;
+        memcpy(&e, data + FREQ_LIST_HEADER + (size_t)b * sizeof(FreqBlock), sizeof(e));
+        return e;
+    }
+
+    void load_block(uint32_t b) {
+        block_no = b;
+        block_first = b * BP128_BLOCK;
+        block_count = std::min<uint32_t>(BP128_BLOCK, n - block_first);
+        uint32_t prev = b > 0 ? block_at(b - 1).last_doc : 0;
+        tfs_in = decode_block(blocks + block_at(b).offset, block_count, prev, CODEC_BP128, docs);
+        tfs_loaded = false;
+        pos = block_first;
+    }
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+
+#include "postings_codec.h"
+
+// On-disk layout of index.bin (v8):
+//
+//   IndexHeader
+//   DictEntry[num_terms]      sorted by term bytes
+//   strings blob              term bytes, referenced by DictEntry::term_offset
+//   postings blob             referenced by DictEntry::postings_offset,
+//                             encoded with DictEntry::codec (postings_codec.h)
+//   positions (optional)      uint64_t[num_terms] offsets into the blob that
+//                             follows, one per DictEntry, then the terms'
+//                             positions lists (positions_codec.h)
+//   frequencies               uint64_t[num_terms] offsets into the blob that
+//                             follows, then the terms' doc id + tf lists
+//                             (frequencies_codec.h)
+//   uint32_t[num_docs]        document lengths in tokens, for BM25
+//
+// Every section starts at an 8-byte aligned offset, so the searcher can mmap
+// the file and use the arrays in place. Readers check the layout with
+// index_layout_valid() first.
+//
+// IndexHeader::flags records how terms were normalized, so the searcher can
+// fold query terms the same way.
+
+const uint32_t INDEX_MAGIC = 0x58444950; // "PIDX"
+const uint32_t INDEX_VERSION = 8;
+
+const uint32_t INDEX_FLAG_FOLD_YO = 1; // ё was folded to е (case_fold.h)
+const uint32_t INDEX_FLAG_STEMMED = 2; // terms are stems (stemmer.h), as in index_stem.bin
+const uint32_t INDEX_FLAG_POSITIONS = 4; // the positions section is present
+const uint32_t INDEX_FLAG_FREQUENCIES = 8; // the frequencies and doc length sections are present
+
+struct IndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_terms;
+    uint32_t codec;
+    uint32_t flags;
+    uint32_t num_docs;
+    uint64_t dict_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t postings_offset;
+    uint64_t postings_size;
+    uint64_t positions_offset;
+    uint64_t positions_size;
+    uint64_t frequencies_offset;
+    uint64_t frequencies_size;
+    uint64_t doc_lengths_offset;
+    uint64_t total_tokens;
+};
+
+struct DictEntry {
+    uint64_t postings_offset;
+    uint32_t postings_bytes;
+    uint32_t doc_freq;
+    uint32_t term_offset;
+    uint16_t term_len;
+    uint16_t codec;
+};
+
+static_assert(sizeof(IndexHeader) == 112, "IndexHeader layout changed");
+static_assert(sizeof(DictEntry) == 24, "DictEntry layout changed");
+
+inline uint64_t align8(uint64_t pos) {
+    return (pos + 7) & ~uint64_t(7);
+}
+
+// [offset, offset + size) lies inside a file of file_size bytes.
+inline bool section_fits(uint64_t offset, uint64_t size, uint64_t file_size) {
+    return offset <= file_size && size <= file_size - offset;
+}
+
+// True if index.bin data of file_size bytes (magic and version already
+// checked) has every section inside the file, the arrays 8-byte aligned,
+// and every dictionary entry and per-term offset inside its section. Every
+// codec must be known, a bitmap must be exactly one bit per doc and a RAW
+// list four bytes per doc, and no term may be in more docs than there are.
+// A truncated or half-written file fails here instead of being read past
+// its end. Costs one pass over the dictionary.
+inline bool index_layout_valid(const char* data, uint64_t file_size) {
+    if (file_size < sizeof(IndexHeader)) return false;
+    const IndexHeader* h = (const IndexHeader*)data;
+    uint64_t table = (uint64_t)h->num_terms * 8;
+    bool positions = h->flags & INDEX_FLAG_POSITIONS;
+    uint64_t bitmap_bytes = bitmap_words(h->num_docs) * 8;
+
+    if (h->codec > CODEC_BITMAP || h->dict_offset % 8 || !section_fits(h->dict_offset, (uint64_t)h->num_terms * sizeof(DictEntry), file_size) ||
+        !section_fits(h->strings_offset, h->strings_size, file_size) ||
+        !section_fits(h->postings_offset, h->postings_size, file_size) || h->postings_offset % 8 ||
+        h->frequencies_offset % 8 || h->frequencies_size < table ||
+        !section_fits(h->frequencies_offset, h->frequencies_size, file_size) || h->doc_lengths_offset % 8 ||
+        !section_fits(h->doc_lengths_offset, (uint64_t)h->num_docs * 4, file_size)) {
+        return false;
+    }
+    if (positions && (h->positions_offset % 8 || h->positions_size < table ||
+                      !section_fits(h->positions_offset, h->positions_size, file_size))) {
+        return false;
+    }
+
+    const DictEntry* dict = (const DictEntry*)(data + h->dict_offset);
+    const uint64_t* term_frequencies = (const uint64_t*)(data + h->frequencies_offset);
+    const uint64_t* term_positions = positions ? (const uint64_t*)(data + h->positions_offset) : nullptr;
+    for (uint32_t t = 0; t < h->num_terms; ++t) {
+        const DictEntry& e = dict[t];
+        if (!section_fits(e.term_offset, e.term_len, h->strings_size) ||
+            !section_fits(e.postings_offset, e.postings_bytes, h->postings_size) ||
+            term_frequencies[t] >= h->frequencies_size - table ||
+            (positions && term_positions[t] >= h->positions_size - table) || e.codec > CODEC_BITMAP ||
+            e.doc_freq > h->num_docs || (e.codec == CODEC_BITMAP && e.postings_bytes != bitmap_bytes) ||
+            (e.codec == CODEC_RAW && e.postings_bytes < (uint64_t)e.doc_freq * 4)) {
+            return false;
+        }
+    }
+    return true;
+}
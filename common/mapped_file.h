@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Read-only memory mapping of a whole file. Pages are loaded lazily by the
+// OS and stay in the page cache, not on our heap.
+class MappedFile {
+private:
+    const char* ptr = nullptr;
+    size_t len = 0;
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return false;
+
+        ptr = static_cast<const char*>(p);
+        len = st.st_size;
+        return true;
+    }
+
+    void close() {
+        if (ptr) munmap(const_cast<char*>(ptr), len);
+        ptr = nullptr;
+        len = 0;
+    }
+
+    const char* data() const { return ptr; }
+    size_t size() const { return len; }
+    bool is_open() const { return ptr != nullptr; }
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "postings_codec.h"
+
+// Positional postings: for every (term, doc) pair, the token offsets of the
+// term in the doc's text, 0-based. They are stored apart from the doc id
+// postings, so boolean queries never touch them.
+//
+// A position record is vbyte(count) followed by count vbyte position gaps
+// (the first gap is the first position itself). A term's positions list is
+// the records of its docs in doc order, each preceded by vbyte(doc gap), in
+// blocks of BP128_BLOCK docs. Lists with more than one block start with a
+// SkipEntry table like the postings (postings_codec.h). Doc ids are repeated
+// here so a list can be searched by doc id, whatever codec the doc id
+// postings were written with, bitmaps included.
+
+inline void encode_position_record(const uint32_t* positions, uint32_t count, std::vector<char>& out) {
+    vbyte_put(out, count);
+    uint32_t prev = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        vbyte_put(out, positions[i] - prev);
+        prev = positions[i];
+    }
+}
+
+inline const uint8_t* skip_position_record(const uint8_t* in) {
+    uint32_t count;
+    in = vbyte_get(in, count);
+    while (count > 0) {
+        if (!(*in++ & 0x80)) count--;
+    }
+    return in;
+}
+
+// `records` is the concatenation of the n docs' position records.
+inline void encode_positions(const uint32_t* docs, size_t n, const char* records, std::vector<char>& out) {
+    uint32_t blocks = num_blocks((uint32_t)n);
+    size_t table_pos = out.size();
+    out.resize(out.size() + skip_table_bytes((uint32_t)n));
+    size_t data_pos = out.size();
+
+    const uint8_t* rec = (const uint8_t*)records;
+    uint32_t prev = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        if (blocks > 1 && i % BP128_BLOCK == 0) {
+            uint32_t last = std::min<uint32_t>(i + BP128_BLOCK, (uint32_t)n) - 1;
+            SkipEntry skip{docs[last], (uint32_t)(out.size() - data_pos)};
+            memcpy(out.data() + table_pos + (i / BP128_BLOCK) * sizeof(SkipEntry), &skip, sizeof(skip));
+        }
+        vbyte_put(out, docs[i] - prev);
+        prev = docs[i];
+
+        const uint8_t* end = skip_position_record(rec);
+        out.insert(out.end(), (const char*)rec, (const char*)end);
+        rec = end;
+    }
+}
+
+// Forward-only lookup of a doc's positions in one term's positions list.
+// Docs must be asked for in ascending order; only the records on the way to
+// the doc are skipped over, and only its own record is decoded. Far jumps
+// go through the skip table.
+class PositionCursor {
+private:
+    const char* data = nullptr;
+    const uint8_t* in = nullptr;
+    uint32_t n = 0;
+    uint32_t idx = 0;
+    uint32_t cur_doc = 0;
+
+public:
+    PositionCursor() = default;
+
+    PositionCursor(const char* list, uint32_t doc_freq) : data(list), n(doc_freq) {
+        if (n > 0) load(0, skip_table_bytes(n), 0);
+    }
+
+    // Positions of `doc` into `out`; false if the term is not in the doc.
+    bool find(uint32_t doc, std::vector<uint32_t>& out) {
+        if (idx >= n) return false;
+        if (cur_doc < doc) {
+            uint32_t total_blocks = num_blocks(n);
+            uint32_t block = idx / BP128_BLOCK;
+            if (total_blocks > 1 && skip_at(block).last_doc < doc) {
+                uint32_t lo = block + 1, hi = total_blocks;
+                while (lo < hi) {
+                    uint32_t mid = lo + (hi - lo) / 2;
+                    if (skip_at(mid).last_doc < doc) lo = mid + 1;
+                    else hi = mid;
+                }
+                if (lo == total_blocks) {
+                    idx = n;
+                    return false;
+                }
+                load(lo, skip_table_bytes(n) + skip_at(lo).offset, skip_at(lo - 1).last_doc);
+            }
+            while (cur_doc < doc) {
+                const uint8_t* next = skip_position_record(in);
+                if (++idx >= n) return false;
+                uint32_t gap;
+                in = vbyte_get(next, gap);
+                cur_doc += gap;
+            }
+        }
+        if (cur_doc != doc) return false;
+
+        uint32_t count, pos = 0;
+        const uint8_t* p = vbyte_get(in, count);
+        out.resize(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t gap;
+            p = vbyte_get(p, gap);
+            pos += gap;
+            out[i] = pos;
+        }
+        return true;
+    }
+
+private:
+    SkipEntry skip_at(uint32_t b) const {
+        SkipEntry e;
+        memcpy(&e, data + (size_t)b * sizeof(SkipEntry), sizeof(e));
+        return e;
+    }
+
+    void load(uint32_t block, size_t offset, uint32_t prev) {
+        idx = block * BP128_BLOCK;
+        uint32_t gap;
+        in = vbyte_get((const uint8_t*)data + offset, gap);
+        cur_doc = prev + gap;
+    }
+};
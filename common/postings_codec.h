@@ -0,0 +1,348 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+// Postings list codecs. All codecs except RAW store doc ids as gaps
+// (doc[i] - doc[i-1], the first gap is doc[0] itself) in blocks of 128.
+//
+//   RAW    uint32_t doc ids as is
+//   VBYTE  gaps as 7-bit groups, high bit set on every byte but the last
+//   BP128  full blocks: one width byte followed by 128 gaps bit-packed into
+//          16 * width bytes; the last partial block is VBYTE
+//   BITMAP one bit per doc id in uint64_t words, 8-byte aligned; chosen by
+//          the indexer for dense terms where it is smaller than the above
+//
+// Lists with more than one block start with a skip table of SkipEntry, one
+// per block, so a cursor can jump to the block holding a target doc id and
+// decode only that block.
+
+enum PostingsCodec : uint16_t {
+    CODEC_RAW = 0,
+    CODEC_VBYTE = 1,
+    CODEC_BP128 = 2,
+    CODEC_BITMAP = 3,
+};
+
+const uint32_t BP128_BLOCK = 128;
+
+struct SkipEntry {
+    uint32_t last_doc;
+    uint32_t offset;
+};
+
+inline uint32_t num_blocks(uint32_t n) {
+    return (n + BP128_BLOCK - 1) / BP128_BLOCK;
+}
+
+inline size_t skip_table_bytes(uint32_t n) {
+    uint32_t blocks = num_blocks(n);
+    return blocks > 1 ? (size_t)blocks * sizeof(SkipEntry) : 0;
+}
+
+inline const char* codec_name(uint16_t codec) {
+    switch (codec) {
+        case CODEC_RAW: return "raw";
+        case CODEC_VBYTE: return "vbyte";
+        case CODEC_BP128: return "bp128";
+        case CODEC_BITMAP: return "bitmap";
+    }
+    return "unknown";
+}
+
+inline void vbyte_put(std::vector<char>& out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back((char)((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+inline const uint8_t* vbyte_get(const uint8_t* in, uint32_t& v) {
+    uint32_t result = *in & 0x7F;
+    int shift = 7;
+    while (*in++ & 0x80) {
+        result |= (uint32_t)(*in & 0x7F) << shift;
+        shift += 7;
+    }
+    v = result;
+    return in;
+}
+
+inline uint32_t bit_width(uint32_t v) {
+    uint32_t w = 0;
+    while (v) { w++; v >>= 1; }
+    return w;
+}
+
+inline void bp128_pack(std::vector<char>& out, const uint32_t* vals, uint32_t width) {
+    uint64_t buf = 0;
+    uint32_t bits = 0;
+    for (uint32_t j = 0; j < BP128_BLOCK; ++j) {
+        buf |= (uint64_t)vals[j] << bits;
+        bits += width;
+        if (bits >= 32) {
+            uint32_t word = (uint32_t)buf;
+            out.insert(out.end(), (const char*)&word, (const char*)&word + 4);
+            buf >>= 32;
+            bits -= 32;
+        }
+    }
+}
+
+template <uint32_t W>
+inline const uint8_t* bp128_unpack_fixed(const uint8_t* in, uint32_t* out) {
+    if (W == 0) {
+        memset(out, 0, BP128_BLOCK * 4);
+        return in;
+    }
+    const uint64_t mask = (W == 32) ? 0xFFFFFFFFull : ((1ull << W) - 1);
+    uint32_t words[W * 4 + 1];
+    memcpy(words, in, W * 16);
+#pragma GCC unroll 128
+    for (uint32_t j = 0; j < BP128_BLOCK; ++j) {
+        const uint32_t bitpos = j * W;
+        const uint32_t w = bitpos >> 5;
+        const uint32_t shift = bitpos & 31;
+        uint64_t v = words[w] >> shift;
+        if (shift + W > 32) v |= (uint64_t)words[w + 1] << (32 - shift);
+        out[j] = (uint32_t)(v & mask);
+    }
+    return in + W * 16;
+}
+
+template <size_t... W>
+inline const uint8_t* bp128_unpack_dispatch(const uint8_t* in, uint32_t width, uint32_t* out,
+                                            std::index_sequence<W...>) {
+    using UnpackFn = const uint8_t* (*)(const uint8_t*, uint32_t*);
+    static const UnpackFn table[] = {&bp128_unpack_fixed<W>...};
+    return table[width](in, out);
+}
+
+inline const uint8_t* bp128_unpack(const uint8_t* in, uint32_t width, uint32_t* out) {
+    return bp128_unpack_dispatch(in, width, out, std::make_index_sequence<33>());
+}
+
+inline void encode_block(const uint32_t* docs, uint32_t count, uint32_t prev, uint16_t codec, std::vector<char>& out) {
+    if (codec == CODEC_BP128 && count == BP128_BLOCK) {
+        uint32_t gaps[BP128_BLOCK];
+        uint32_t max_gap = 0;
+        for (uint32_t j = 0; j < BP128_BLOCK; ++j) {
+            gaps[j] = docs[j] - prev;
+            prev = docs[j];
+            max_gap |= gaps[j];
+        }
+        uint32_t width = bit_width(max_gap);
+        out.push_back((char)width);
+        bp128_pack(out, gaps, width);
+        return;
+    }
+
+    for (uint32_t j = 0; j < count; ++j) {
+        vbyte_put(out, docs[j] - prev);
+        prev = docs[j];
+    }
+}
+
+inline const uint8_t* decode_block(const uint8_t* in, uint32_t count, uint32_t prev, uint16_t codec, uint32_t* out) {
+    if (codec == CODEC_BP128 && count == BP128_BLOCK) {
+        uint32_t width = *in++;
+        in = bp128_unpack(in, width, out);
+        for (uint32_t j = 0; j < BP128_BLOCK; ++j) {
+            prev += out[j];
+            out[j] = prev;
+        }
+        return in;
+    }
+
+    for (uint32_t j = 0; j < count; ++j) {
+        uint32_t gap;
+        in = vbyte_get(in, gap);
+        prev += gap;
+        out[j] = prev;
+    }
+    return in;
+}
+
+inline void encode_postings(const uint32_t* docs, size_t n, uint16_t codec, std::vector<char>& out) {
+    if (codec == CODEC_RAW) {
+        out.insert(out.end(), (const char*)docs, (const char*)(docs + n));
+        return;
+    }
+
+    uint32_t blocks = num_blocks((uint32_t)n);
+    size_t table_pos = out.size();
+    out.resize(out.size() + skip_table_bytes((uint32_t)n));
+    size_t data_pos = out.size();
+
+    uint32_t prev = 0;
+    for (uint32_t b = 0; b < blocks; ++b) {
+        uint32_t first = b * BP128_BLOCK;
+        uint32_t count = std::min<uint32_t>(BP128_BLOCK, (uint32_t)n - first);
+
+        SkipEntry skip{docs[first + count - 1], (uint32_t)(out.size() - data_pos)};
+        encode_block(docs + first, count, prev, codec, out);
+        prev = skip.last_doc;
+
+        if (blocks > 1) memcpy(out.data() + table_pos + b * sizeof(SkipEntry), &skip, sizeof(skip));
+    }
+}
+
+inline size_t bitmap_words(uint32_t total_docs) {
+    return (total_docs + 63) / 64;
+}
+
+inline void encode_bitmap(const uint32_t* docs, size_t n, uint32_t total_docs, std::vector<char>& out) {
+    std::vector<uint64_t> words(bitmap_words(total_docs), 0);
+    for (size_t i = 0; i < n; ++i) words[docs[i] >> 6] |= 1ull << (docs[i] & 63);
+    out.insert(out.end(), (const char*)words.data(), (const char*)(words.data() + words.size()));
+}
+
+inline void decode_postings(const char* data, uint32_t n, uint16_t codec, uint32_t* out) {
+    if (codec == CODEC_RAW) {
+        memcpy(out, data, (size_t)n * 4);
+        return;
+    }
+
+    if (codec == CODEC_BITMAP) {
+        uint32_t found = 0;
+        for (uint32_t w = 0; found < n; ++w) {
+            uint64_t word;
+            memcpy(&word, data + (size_t)w * 8, 8);
+            while (word) {
+                out[found++] = w * 64 + __builtin_ctzll(word);
+                word &= word - 1;
+            }
+        }
+        return;
+    }
+
+    const uint8_t* in = (const uint8_t*)data + skip_table_bytes(n);
+    uint32_t prev = 0;
+    for (uint32_t first = 0; first < n; first += BP128_BLOCK) {
+        uint32_t count = std::min<uint32_t>(BP128_BLOCK, n - first);
+        in = decode_block(in, count, prev, codec, out + first);
+        prev = out[first + count - 1];
+    }
+}
+
+// Forward-only iterator over an encoded postings list. advance(target)
+// moves to the first doc id >= target: RAW lists are galloped over in place,
+// blocked lists consult the skip table and decode only the block they land in.
+class PostingCursor {
+private:
+    const char* data = nullptr;
+    const uint8_t* blocks = nullptr;
+    uint32_t n = 0;
+    uint16_t codec = CODEC_RAW;
+
+    uint32_t pos = 0;
+    uint32_t cur_doc = 0;
+
+    uint32_t block_no = UINT32_MAX;
+    uint32_t block_first = 0;
+    uint32_t block_count = 0;
+    uint32_t buf[BP128_BLOCK];
+
+public:
+    PostingCursor() = default;
+
+    PostingCursor(const char* list, uint32_t doc_freq, uint16_t list_codec)
+        : data(list), n(doc_freq), codec(list_codec) {
+        blocks = (const uint8_t*)data + (codec == CODEC_RAW ? 0 : skip_table_bytes(n));
+        seek(0);
+    }
+
+    uint32_t size() const { return n; }
+    bool at_end() const { return pos >= n; }
+    uint32_t doc() const { return cur_doc; }
+
+    void next() {
+        seek(pos + 1);
+    }
+
+    void advance(uint32_t target) {
+        if (at_end() || cur_doc >= target) return;
+
+        if (codec == CODEC_RAW) {
+            uint32_t lo = pos, step = 1;
+            uint32_t hi = pos + 1;
+            while (hi < n && raw_at(hi) < target) {
+                lo = hi;
+                step *= 2;
+                hi = pos + step;
+            }
+            if (hi > n) hi = n;
+            while (lo < hi) {
+                uint32_t mid = lo + (hi - lo) / 2;
+                if (raw_at(mid) < target) lo = mid + 1;
+                else hi = mid;
+            }
+            seek(lo);
+            return;
+        }
+
+        if (buf[block_count - 1] < target) {
+            uint32_t total_blocks = num_blocks(n);
+            uint32_t lo = block_no + 1, hi = total_blocks;
+            while (lo < hi) {
+                uint32_t mid = lo + (hi - lo) / 2;
+                if (skip_at(mid).last_doc < target) lo = mid + 1;
+                else hi = mid;
+            }
+            if (lo == total_blocks) {
+                pos = n;
+                return;
+            }
+            load_block(lo);
+        }
+
+        uint32_t* from = buf + (pos - block_first);
+        uint32_t* it = std::lower_bound(from, buf + block_count, target);
+        seek(block_first + (uint32_t)(it - buf));
+    }
+
+private:
+    uint32_t raw_at(uint32_t i) const {
+        uint32_t v;
+        memcpy(&v, data + (size_t)i * 4, 4);
+        return v;
+    }
+
+    SkipEntry skip_at(uint32_t b) const {
+        SkipEntry e;
+        memcpy(&e, data + (size_t)b * sizeof(SkipEntry), sizeof(e));
+        return e;
+    }
+
+    void load_block(uint32_t b) {
+        block_no = b;
+        block_first = b * BP128_BLOCK;
+        block_count = std::min<uint32_t>(BP128_BLOCK, n - block_first);
+
+        uint32_t prev = 0;
+        uint32_t offset = 0;
+        if (num_blocks(n) > 1) {
+            offset = skip_at(b).offset;
+            if (b > 0) prev = skip_at(b - 1).last_doc;
+        }
+        decode_block(blocks + offset, block_count, prev, codec, buf);
+        pos = block_first;
+    }
+
+    void seek(uint32_t i) {
+        pos = i;
+        if (pos >= n) return;
+
+        if (codec == CODEC_RAW) {
+            cur_doc = raw_at(pos);
+            return;
+        }
+        if (block_no == UINT32_MAX || pos >= block_first + block_count) load_block(pos / BP128_BLOCK);
+        pos = i;
+        cur_doc = buf[pos - block_first];
+    }
+};
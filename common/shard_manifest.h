@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// manifest.txt lists the shards of a sharded index, or the segments of an
+// incrementally built one, one per line:
+//
+//   doc_base \t num_docs \t directory
+//
+// Each directory holds an ordinary docs.bin / index.bin (and the optional
+// index_stem.bin) with doc ids from 0; global doc id = doc_base + local id.
+// Directories are relative to the manifest's own directory. Lines starting
+// with '#' are comments. The file is small text on purpose, so shards can be
+// rebuilt or moved one at a time and the list edited by hand.
+//
+// A directory may also hold deleted.bin: tombstones, one bit per local doc
+// id (bit d % 64 of word d / 64), set for docs that no longer match any
+// query. Segments are immutable otherwise; deleted docs are dropped when
+// segments are merged.
+
+const std::string MANIFEST_NAME = "manifest.txt";
+const std::string TOMBSTONES_NAME = "deleted.bin";
+
+struct ShardInfo {
+    uint32_t doc_base;
+    uint32_t num_docs;
+    std::string dir;
+};
+
+// Shards sorted by doc_base; false if the file is missing or malformed, or
+// if two shards' doc id ranges overlap.
+inline bool read_manifest(const std::string& path, std::vector<ShardInfo>& shards) {
+    std::ifstream in(path);
+    if (!in) return false;
+
+    shards.clear();
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream fields(line);
+        ShardInfo s;
+        if (!(fields >> s.doc_base >> s.num_docs) || !std::getline(fields >> std::ws, s.dir) || s.dir.empty()) {
+            return false;
+        }
+        shards.push_back(s);
+    }
+
+    std::sort(shards.begin(), shards.end(),
+              [](const ShardInfo& a, const ShardInfo& b) { return a.doc_base < b.doc_base; });
+    for (size_t i = 1; i < shards.size(); ++i) {
+        if ((uint64_t)shards[i - 1].doc_base + shards[i - 1].num_docs > shards[i].doc_base) return false;
+    }
+    return !shards.empty();
+}
+
+// Written to a temporary file and renamed over the old one, so a searcher
+// reloading the manifest never sees it half written.
+inline bool write_manifest(const std::string& path, const std::vector<ShardInfo>& shards) {
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp);
+        if (!out) return false;
+        out << "# doc_base\tnum_docs\tdirectory\n";
+        for (const ShardInfo& s : shards) out << s.doc_base << "\t" << s.num_docs << "\t" << s.dir << "\n";
+        if (!out) return false;
+    }
+    return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+// Tombstones of a directory with `num_docs` docs; all clear without a
+// deleted.bin.
+inline std::vector<uint64_t> read_tombstones(const std::string& dir, uint32_t num_docs) {
+    std::vector<uint64_t> bits((num_docs + 63) / 64, 0);
+    std::ifstream in(dir + TOMBSTONES_NAME, std::ios::binary);
+    if (in) in.read((char*)bits.data(), bits.size() * 8);
+    return bits;
+}
+
+inline bool write_tombstones(const std::string& dir, const std::vector<uint64_t>& bits) {
+    std::string path = dir + TOMBSTONES_NAME;
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary);
+        if (!out) return false;
+        out.write((const char*)bits.data(), bits.size() * 8);
+        if (!out) return false;
+    }
+    return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+#include "stemmer.h"
+
+// Memo table in front of stem_length(). Token streams are Zipfian, so a
+// few thousand surface forms make up most tokens. The table is direct
+// mapped with one 64-byte slot per word, holding the word and its stem
+// length, so a lookup touches a single cache line. On a collision the new
+// word replaces the old one. Words longer than a slot can hold skip the
+// cache. Not thread-safe: give each thread its own instance.
+
+const size_t STEM_CACHE_SLOTS = 4096;
+
+class StemCache {
+public:
+    static const size_t MAX_WORD = 62;
+
+private:
+    struct alignas(64) Slot {
+        uint8_t len;
+        uint8_t stem_len;
+        char word[MAX_WORD];
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t num_slots;
+    int shift;
+    uint64_t num_hits = 0;
+    uint64_t num_misses = 0;
+    uint64_t num_uncached = 0;
+
+    // Mixes the first and last 8 bytes with the length, which is enough to
+    // spread words that share a stem and cheaper than hashing every byte.
+    // The slot is taken from the top bits, the well-mixed end of a product.
+    size_t slot_of(std::string_view w) const {
+        uint64_t head = 0, tail = 0;
+        size_t n = std::min<size_t>(w.size(), 8);
+        memcpy(&head, w.data(), n);
+        memcpy(&tail, w.data() + w.size() - n, n);
+        uint64_t h = (head * 0x9E3779B97F4A7C15ull) ^ tail ^ w.size();
+        return (h * 0xC2B2AE3D27D4EB4Full) >> shift;
+    }
+
+public:
+    // `capacity` is rounded up to a power of two.
+    explicit StemCache(size_t capacity = STEM_CACHE_SLOTS) {
+        num_slots = 1;
+        shift = 64;
+        while (num_slots < capacity) {
+            num_slots <<= 1;
+            shift--;
+        }
+        slots.reset(new Slot[num_slots]);
+        for (size_t i = 0; i < num_slots; ++i) slots[i].len = 0;
+    }
+
+    size_t stem_length(std::string_view word) {
+        if (word.empty() || word.size() > MAX_WORD) {
+            num_uncached++;
+            return ::stem_length(word);
+        }
+
+        Slot& slot = slots[shift < 64 ? slot_of(word) : 0];
+        if (slot.len == word.size() && memcmp(slot.word, word.data(), word.size()) == 0) {
+            num_hits++;
+            return slot.stem_len;
+        }
+
+        num_misses++;
+        size_t len = ::stem_length(word);
+        slot.len = (uint8_t)word.size();
+        slot.stem_len = (uint8_t)len;
+        memcpy(slot.word, word.data(), word.size());
+        return len;
+    }
+
+    std::string_view stem(std::string_view word) { return word.substr(0, stem_length(word)); }
+
+    uint64_t hits() const { return num_hits; }
+    uint64_t misses() const { return num_misses; }
+    uint64_t uncached() const { return num_uncached; }
+    uint64_t lookups() const { return num_hits + num_misses + num_uncached; }
+    double hit_rate() const { return lookups() ? (double)num_hits / lookups() : 0.0; }
+    size_t memory_bytes() const { return num_slots * sizeof(Slot); }
+};
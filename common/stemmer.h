@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// Suffix-stripping stemmer for Russian and English. The suffix lists are
+// compiled at compile time into a trie over reversed UTF-8 bytes, so one
+// walk from the end of a word finds every matching suffix; the longest one
+// that leaves a stem of at least STEM_MIN_BYTES is stripped. Words of at
+// most STEM_SHORT_WORD bytes are left alone. Input is expected lowercased
+// (case_fold.h); nothing is allocated.
+
+const size_t STEM_MIN_BYTES = 3;
+const size_t STEM_SHORT_WORD = 4;
+
+constexpr std::string_view STEM_SUFFIXES[] = {
+    // Russian
+    "вшимися", "вшими", "вшем", "вшего", "вшая", "вшие", "вшую", "вшим",
+    "щимися", "щими", "вше", "вши",
+    "иеся", "аяся", "оеся", "ыеся", "имися", "ымися",
+    "ившийся", "ывшийся", "ившись", "ывшись",
+    "уюся", "ююся", "авше", "авши", "евше", "евши",
+    "ившая", "ывшая", "ившее", "ывшее", "ившие", "ывшие",
+    "ивший", "ывший", "ившую", "ывшую", "ившим", "ывшим",
+    "ующая", "юющая", "ующее", "юющее", "ующие", "юющие",
+    "ующий", "юющий", "ующую", "юющую", "ующим", "юющим",
+    "авшем", "авшего", "авшую", "авшим", "евшем", "евшего", "евшую", "евшим",
+    "ки", "ие", "ые", "ое", "ий", "ый", "ой", "ей", "уй", "ая", "яя", "ою", "ею",
+    "ями", "ами", "ье", "иям", "иях", "ием", "иев", "ям", "ем", "ам", "ом",
+    "ах", "ях", "ых", "их", "ов", "ев", "ью",
+    "ешь", "ете", "ишь", "ите", "ят", "ут", "ют", "ит", "ет", "ть", "ти", "л", "ла", "ло", "ли",
+    "а", "е", "и", "о", "у", "ы", "э", "ю", "я", "й", "ь",
+    // English
+    "ational", "tional", "enci", "anci", "izer", "bli", "alli", "entli", "eli", "ousli",
+    "ization", "ation", "ator", "alism", "iveness", "fulness", "ousness", "aliti", "iviti", "biliti",
+    "logi", "icate", "ative", "alize", "iciti", "ical", "ful", "ness",
+    "ing", "ed", "es", "ly", "s",
+};
+
+// Reversed-suffix trie. Children of the root are found through a 256-entry
+// table, deeper children through first_child/next_sibling lists, which are
+// one or two entries long for these suffixes.
+struct SuffixTrie {
+    static const int MAX_NODES = 1024;
+
+    struct Node {
+        uint8_t label;
+        bool terminal;
+        uint16_t first_child;
+        uint16_t next_sibling;
+    };
+
+    uint16_t root[256];
+    Node nodes[MAX_NODES];
+    int num_nodes;
+
+    constexpr uint16_t child(uint16_t node, uint8_t c) const {
+        for (uint16_t n = nodes[node].first_child; n != 0; n = nodes[n].next_sibling) {
+            if (nodes[n].label == c) return n;
+        }
+        return 0;
+    }
+};
+
+constexpr SuffixTrie build_suffix_trie() {
+    SuffixTrie t{};
+    t.num_nodes = 1; // node 0 is the root and doubles as "no node"
+    for (std::string_view suffix : STEM_SUFFIXES) {
+        uint16_t node = 0;
+        for (size_t i = suffix.size(); i-- > 0;) {
+            uint8_t c = (uint8_t)suffix[i];
+            uint16_t next = node == 0 ? t.root[c] : t.child(node, c);
+            if (next == 0) {
+                next = (uint16_t)t.num_nodes++;
+                t.nodes[next] = {c, false, 0, t.nodes[node].first_child};
+                if (node == 0) t.root[c] = next;
+                else t.nodes[node].first_child = next;
+            }
+            node = next;
+        }
+        t.nodes[node].terminal = true;
+    }
+    return t;
+}
+
+inline constexpr SuffixTrie STEM_TRIE = build_suffix_trie();
+
+static_assert(STEM_TRIE.num_nodes < SuffixTrie::MAX_NODES, "SuffixTrie::MAX_NODES too small");
+
+// Length in bytes of the stem of `word`, i.e. the prefix to keep.
+constexpr size_t stem_length(std::string_view word) {
+    size_t len = word.size();
+    if (len <= STEM_SHORT_WORD) return len;
+
+    size_t stem = len;
+    uint16_t node = STEM_TRIE.root[(uint8_t)word[len - 1]];
+    size_t depth = 1;
+    while (node != 0 && len - depth >= STEM_MIN_BYTES) {
+        if (STEM_TRIE.nodes[node].terminal) stem = len - depth;
+        node = STEM_TRIE.child(node, (uint8_t)word[len - 1 - depth]);
+        depth++;
+    }
+    return stem;
+}
+
+constexpr std::string_view stem(std::string_view word) {
+    return word.substr(0, stem_length(word));
+}
+
+static_assert(stem("системами") == "систем", "stemmer: longest Russian suffix");
+static_assert(stem("читавшего") == "чит", "stemmer: longest participle suffix");
+static_assert(stem("nationalization") == "national", "stemmer: longest English suffix");
+static_assert(stem("uses") == "uses", "stemmer: short words are kept");
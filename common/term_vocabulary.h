@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Bump allocator for term bytes. Terms are never freed individually, so
+// they are packed into large blocks instead of one heap string each.
+class TermArena {
+private:
+    static constexpr size_t BLOCK_SIZE = 1 << 20;
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char* cur = nullptr;
+    size_t left = 0;
+    size_t used = 0;
+
+public:
+    std::string_view store(std::string_view s) {
+        if (s.size() > left) {
+            size_t size = std::max(BLOCK_SIZE, s.size());
+            blocks.emplace_back(new char[size]);
+            cur = blocks.back().get();
+            left = size;
+        }
+        memcpy(cur, s.data(), s.size());
+        std::string_view stored(cur, s.size());
+        cur += s.size();
+        left -= s.size();
+        used += s.size();
+        return stored;
+    }
+
+    size_t bytes_used() const { return used; }
+};
+
+inline uint64_t hash_term(std::string_view s) {
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// Open-addressing hash table interning terms to dense ids 0, 1, 2, ...
+// in first-seen order.
+class TermVocabulary {
+private:
+    struct Slot {
+        uint32_t id;
+        uint32_t hash;
+    };
+
+    static const uint32_t EMPTY = UINT32_MAX;
+
+    std::vector<Slot> slots;
+    std::vector<std::string_view> terms;
+    TermArena arena;
+    size_t mask = 0;
+
+public:
+    static const uint32_t NOT_FOUND = UINT32_MAX;
+
+    TermVocabulary() {
+        slots.assign(1 << 16, {EMPTY, 0});
+        mask = slots.size() - 1;
+    }
+
+    uint32_t intern(std::string_view s) {
+        uint64_t h = hash_term(s);
+        size_t i = h & mask;
+        while (true) {
+            Slot& slot = slots[i];
+            if (slot.id == EMPTY) break;
+            if (slot.hash == (uint32_t)h && terms[slot.id] == s) return slot.id;
+            i = (i + 1) & mask;
+        }
+
+        uint32_t id = (uint32_t)terms.size();
+        terms.push_back(arena.store(s));
+        slots[i] = {id, (uint32_t)h};
+        if (terms.size() * 2 > slots.size()) grow();
+        return id;
+    }
+
+    uint32_t find(std::string_view s) const {
+        uint64_t h = hash_term(s);
+        size_t i = h & mask;
+        while (slots[i].id != EMPTY) {
+            if (slots[i].hash == (uint32_t)h && terms[slots[i].id] == s) return slots[i].id;
+            i = (i + 1) & mask;
+        }
+        return NOT_FOUND;
+    }
+
+    std::string_view term(uint32_t id) const { return terms[id]; }
+    uint32_t size() const { return (uint32_t)terms.size(); }
+
+    size_t memory_bytes() const {
+        return slots.size() * sizeof(Slot) + terms.capacity() * sizeof(std::string_view) + arena.bytes_used();
+    }
+
+private:
+    void grow() {
+        std::vector<Slot> old;
+        old.swap(slots);
+        slots.assign(old.size() * 2, {EMPTY, 0});
+        mask = slots.size() - 1;
+        for (const Slot& slot : old) {
+            if (slot.id == EMPTY) continue;
+            size_t i = slot.hash & mask;
+            while (slots[i].id != EMPTY) i = (i + 1) & mask;
+            slots[i] = slot;
+        }
+    }
+};
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include "cpu_features.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Tokenization rules shared by all labs:
+//   - letters, digits and every non-ASCII byte (UTF-8) belong to a token;
+//   - '.', '-' and '_' belong to a token when both neighbours are alnum
+//     (versions 2.0, IPs, wi-fi, snake_case);
+//   - '+' belongs to a token after an alnum or another '+' (c++, g++).
+//
+// for_each_token() calls emit(std::string_view) for every token, pointing
+// into the input text; nothing is copied or allocated. The text is
+// classified 64 bytes at a time into bit masks (AVX2 if the CPU has it,
+// else SSE2/NEON or scalar) and tokens are cut from the mask transitions.
+
+inline bool is_token_alnum(unsigned char c) {
+    return c >= 0x80 || (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z');
+}
+
+struct ByteClassMasks {
+    uint64_t alnum;
+    uint64_t dot;
+    uint64_t dash;
+    uint64_t plus;
+    uint64_t under;
+};
+
+inline ByteClassMasks classify_scalar(const unsigned char* p) {
+    ByteClassMasks m{0, 0, 0, 0, 0};
+    for (int i = 0; i < 64; ++i) {
+        uint64_t bit = 1ull << i;
+        unsigned char c = p[i];
+        if (is_token_alnum(c)) m.alnum |= bit;
+        else if (c == '.') m.dot |= bit;
+        else if (c == '-') m.dash |= bit;
+        else if (c == '+') m.plus |= bit;
+        else if (c == '_') m.under |= bit;
+    }
+    return m;
+}
+
+#if defined(HAVE_AVX2_TARGET)
+
+AVX2_TARGET inline ByteClassMasks classify64_avx2(const unsigned char* p) {
+    ByteClassMasks m;
+    uint64_t masks[5][2];
+    for (int half = 0; half < 2; ++half) {
+        __m256i c = _mm256_loadu_si256((const __m256i*)(p + half * 32));
+        __m256i digit = _mm256_cmpeq_epi8(_mm256_min_epu8(_mm256_sub_epi8(c, _mm256_set1_epi8('0')), _mm256_set1_epi8(9)),
+                                          _mm256_sub_epi8(c, _mm256_set1_epi8('0')));
+        __m256i lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+        __m256i alpha = _mm256_cmpeq_epi8(_mm256_min_epu8(_mm256_sub_epi8(lower, _mm256_set1_epi8('a')), _mm256_set1_epi8(25)),
+                                          _mm256_sub_epi8(lower, _mm256_set1_epi8('a')));
+        uint32_t high = (uint32_t)_mm256_movemask_epi8(c);
+        masks[0][half] = high | (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(digit, alpha));
+        masks[1][half] = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('.')));
+        masks[2][half] = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('-')));
+        masks[3][half] = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('+')));
+        masks[4][half] = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('_')));
+    }
+    m.alnum = masks[0][0] | (masks[0][1] << 32);
+    m.dot = masks[1][0] | (masks[1][1] << 32);
+    m.dash = masks[2][0] | (masks[2][1] << 32);
+    m.plus = masks[3][0] | (masks[3][1] << 32);
+    m.under = masks[4][0] | (masks[4][1] << 32);
+    return m;
+}
+
+#endif
+
+#if defined(__SSE2__)
+
+inline ByteClassMasks classify64_baseline(const unsigned char* p) {
+    ByteClassMasks m{0, 0, 0, 0, 0};
+    for (int q = 0; q < 4; ++q) {
+        __m128i c = _mm_loadu_si128((const __m128i*)(p + q * 16));
+        __m128i d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+        __m128i digit = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+        __m128i a = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+        __m128i alpha = _mm_cmpeq_epi8(_mm_min_epu8(a, _mm_set1_epi8(25)), a);
+        int shift = q * 16;
+        m.alnum |= (uint64_t)(uint32_t)(_mm_movemask_epi8(c) | _mm_movemask_epi8(_mm_or_si128(digit, alpha))) << shift;
+        m.dot |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('.'))) << shift;
+        m.dash |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('-'))) << shift;
+        m.plus |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('+'))) << shift;
+        m.under |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('_'))) << shift;
+    }
+    return m;
+}
+
+#elif defined(__ARM_NEON)
+
+inline uint64_t neon_movemask64(uint8x16_t m0, uint8x16_t m1, uint8x16_t m2, uint8x16_t m3) {
+    const uint8x16_t bits = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t s0 = vpaddq_u8(vandq_u8(m0, bits), vandq_u8(m1, bits));
+    uint8x16_t s1 = vpaddq_u8(vandq_u8(m2, bits), vandq_u8(m3, bits));
+    s0 = vpaddq_u8(s0, s1);
+    s0 = vpaddq_u8(s0, s0);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(s0), 0);
+}
+
+inline ByteClassMasks classify64_baseline(const unsigned char* p) {
+    uint8x16_t c[4], alnum[4], dot[4], dash[4], plus[4], under[4];
+    for (int q = 0; q < 4; ++q) {
+        c[q] = vld1q_u8(p + q * 16);
+        uint8x16_t digit = vcleq_u8(vsubq_u8(c[q], vdupq_n_u8('0')), vdupq_n_u8(9));
+        uint8x16_t alpha = vcleq_u8(vsubq_u8(vorrq_u8(c[q], vdupq_n_u8(0x20)), vdupq_n_u8('a')), vdupq_n_u8(25));
+        uint8x16_t high = vcgeq_u8(c[q], vdupq_n_u8(0x80));
+        alnum[q] = vorrq_u8(vorrq_u8(digit, alpha), high);
+        dot[q] = vceqq_u8(c[q], vdupq_n_u8('.'));
+        dash[q] = vceqq_u8(c[q], vdupq_n_u8('-'));
+        plus[q] = vceqq_u8(c[q], vdupq_n_u8('+'));
+        under[q] = vceqq_u8(c[q], vdupq_n_u8('_'));
+    }
+    ByteClassMasks m;
+    m.alnum = neon_movemask64(alnum[0], alnum[1], alnum[2], alnum[3]);
+    m.dot = neon_movemask64(dot[0], dot[1], dot[2], dot[3]);
+    m.dash = neon_movemask64(dash[0], dash[1], dash[2], dash[3]);
+    m.plus = neon_movemask64(plus[0], plus[1], plus[2], plus[3]);
+    m.under = neon_movemask64(under[0], under[1], under[2], under[3]);
+    return m;
+}
+
+#else
+
+inline ByteClassMasks classify64_baseline(const unsigned char* p) {
+    return classify_scalar(p);
+}
+
+#endif
+
+inline ByteClassMasks classify64(const unsigned char* p) {
+#if defined(HAVE_AVX2_TARGET)
+    if (cpu_has_avx2()) return classify64_avx2(p);
+#endif
+    return classify64_baseline(p);
+}
+
+// Scalar reference implementation of the same rules, byte at a time.
+template <typename Emit>
+void for_each_token_scalar(std::string_view text, Emit&& emit) {
+    size_t len = text.size();
+    size_t start = 0;
+    bool in_token = false;
+
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = text[i];
+        bool is_word = is_token_alnum(c);
+
+        if (!is_word && i > 0) {
+            unsigned char prev = text[i - 1];
+            bool next_alnum = i + 1 < len && is_token_alnum(text[i + 1]);
+            if (c == '.' || c == '-' || c == '_') is_word = is_token_alnum(prev) && next_alnum;
+            else if (c == '+') is_word = is_token_alnum(prev) || prev == '+';
+        }
+
+        if (is_word && !in_token) {
+            start = i;
+            in_token = true;
+        } else if (!is_word && in_token) {
+            emit(text.substr(start, i - start));
+            in_token = false;
+        }
+    }
+    if (in_token) emit(text.substr(start));
+}
+
+template <typename Emit>
+void for_each_token(std::string_view text, Emit&& emit) {
+    const unsigned char* data = (const unsigned char*)text.data();
+    const size_t len = text.size();
+    const size_t blocks = (len + 63) / 64;
+
+    auto load = [&](size_t b) -> ByteClassMasks {
+        if ((b + 1) * 64 <= len) return classify64(data + b * 64);
+        unsigned char tail[64] = {0};
+        if (b * 64 < len) memcpy(tail, data + b * 64, len - b * 64);
+        return classify64(tail);
+    };
+
+    ByteClassMasks cur = load(0);
+    uint64_t prev_alnum = 0, prev_plus = 0, prev_word = 0;
+    size_t token_start = 0;
+
+    for (size_t b = 0; b < blocks; ++b) {
+        ByteClassMasks next = load(b + 1);
+
+        // Neighbour masks: bit i of before_* is the class of byte i - 1,
+        // bit i of after_alnum is the class of byte i + 1.
+        uint64_t before_alnum = (cur.alnum << 1) | prev_alnum;
+        uint64_t before_plus = (cur.plus << 1) | prev_plus;
+        uint64_t after_alnum = (cur.alnum >> 1) | (next.alnum << 63);
+
+        uint64_t inner = before_alnum & after_alnum;
+        uint64_t word = cur.alnum | ((cur.dot | cur.dash | cur.under) & inner) | (cur.plus & (before_alnum | before_plus));
+
+        uint64_t starts = word & ~((word << 1) | prev_word);
+        uint64_t ends = ~word & ((word << 1) | prev_word);
+
+        while (starts | ends) {
+            uint64_t s = starts ? (uint64_t)__builtin_ctzll(starts) : 64;
+            uint64_t e = ends ? (uint64_t)__builtin_ctzll(ends) : 64;
+            if (e < s) {
+                size_t end = b * 64 + e;
+                emit(std::string_view((const char*)data + token_start, end - token_start));
+                ends &= ends - 1;
+            } else {
+                token_start = b * 64 + s;
+                starts &= starts - 1;
+            }
+        }
+
+        prev_alnum = cur.alnum >> 63;
+        prev_plus = cur.plus >> 63;
+        prev_word = word >> 63;
+        cur = next;
+    }
+
+    if (prev_word) emit(std::string_view((const char*)data + token_start, len - token_start));
+}
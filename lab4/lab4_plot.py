@@ -1,10 +1,108 @@
+import os
+import struct
+
 import pandas as pd
 import matplotlib.pyplot as plt
 import numpy as np
 
+STATS_FILE = "../data/index_stats.bin"
+STATS_MAGIC = 0x41545350
+STATS_HEADER = struct.Struct("<IIIIQQIIII")
+TERM_STAT = struct.Struct("<QIIII")
+HEAPS_POINT = struct.Struct("<QQ")
+
+
+def align8(pos):
+    return (pos + 7) & ~7
+
+
+def load_index_stats(path):
+    """Reads the collection statistics the indexer writes next to index.bin
+    (layout in common/collection_stats.h)."""
+    with open(path, "rb") as f:
+        data = f.read()
+
+    (magic, version, num_docs, num_terms, total_tokens, strings_size,
+     num_heaps, num_doclen, num_postings, _) = STATS_HEADER.unpack_from(data, 0)
+    if magic != STATS_MAGIC or version != 1:
+        raise ValueError(f"{path}: unsupported stats format")
+
+    pos = align8(STATS_HEADER.size)
+    terms = list(TERM_STAT.iter_unpack(data[pos:pos + num_terms * TERM_STAT.size]))
+    pos = align8(pos + num_terms * TERM_STAT.size)
+    strings = data[pos:pos + strings_size]
+    pos = align8(pos + strings_size)
+    heaps = list(HEAPS_POINT.iter_unpack(data[pos:pos + num_heaps * HEAPS_POINT.size]))
+    pos = align8(pos + num_heaps * HEAPS_POINT.size)
+    doc_lengths = struct.unpack_from(f"<{num_doclen}Q", data, pos)
+    pos += num_doclen * 8
+    postings = struct.unpack_from(f"<{num_postings}Q", data, pos)
+
+    words = [strings[off:off + n].decode("utf-8", "replace") for _, _, off, n, _ in terms]
+    df = pd.DataFrame({
+        "rank": np.arange(1, num_terms + 1),
+        "word": words,
+        "frequency": [t[0] for t in terms],
+        "doc_frequency": [t[1] for t in terms],
+    })
+    return {
+        "docs": num_docs,
+        "tokens": total_tokens,
+        "zipf": df,
+        "heaps": np.array(heaps, dtype=float),
+        "doc_lengths": np.array(doc_lengths),
+        "postings": np.array(postings),
+    }
+
+
+def plot_collection_stats(stats):
+    fig, (ax_heaps, ax_docs, ax_post) = plt.subplots(1, 3, figsize=(18, 5))
+
+    tokens, vocab = stats["heaps"][:, 0], stats["heaps"][:, 1]
+    fit = tokens > tokens.max() * 0.01
+    beta, log_k = np.polyfit(np.log(tokens[fit]), np.log(vocab[fit]), 1)
+    K = np.exp(log_k)
+    ax_heaps.loglog(tokens, vocab, label="Vocabulary size", color="blue")
+    ax_heaps.loglog(tokens, K * tokens ** beta, "--", color="red", label=f"Heaps: {K:.1f} * N^{beta:.3f}")
+    ax_heaps.set_title("Heaps' Law")
+    ax_heaps.set_xlabel("Tokens (Log scale)")
+    ax_heaps.set_ylabel("Distinct terms (Log scale)")
+    ax_heaps.grid(True, which="both", ls="-", alpha=0.2)
+    ax_heaps.legend()
+
+    buckets = [f"{2 ** b - 1}" for b in range(len(stats["doc_lengths"]))]
+    last = np.nonzero(stats["doc_lengths"])[0].max() + 1
+    ax_docs.bar(buckets[:last], stats["doc_lengths"][:last], color="green")
+    ax_docs.set_title(f"Document length ({stats['docs']} docs)")
+    ax_docs.set_xlabel("Tokens, from (log2 buckets)")
+    ax_docs.set_ylabel("Documents")
+    ax_docs.tick_params(axis="x", rotation=60)
+
+    post_buckets = [f"{2 ** b}" for b in range(len(stats["postings"]))]
+    last = np.nonzero(stats["postings"])[0].max() + 1
+    ax_post.bar(post_buckets[:last], stats["postings"][:last], color="orange")
+    ax_post.set_yscale("log")
+    ax_post.set_title("Postings list length")
+    ax_post.set_xlabel("Documents per term, from (log2 buckets)")
+    ax_post.set_ylabel("Terms (Log scale)")
+    ax_post.tick_params(axis="x", rotation=60)
+
+    plt.tight_layout()
+    output_img = "lab4_collection_stats.png"
+    plt.savefig(output_img)
+    print(f"Graph saved to {output_img}")
+    print(f"Heaps' law fit: V = {K:.2f} * N^{beta:.3f}")
+
+
 def main():
-    print("Loading CSV data...")
-    df = pd.read_csv("zipf_data.csv")
+    stats = None
+    if os.path.exists(STATS_FILE):
+        print(f"Loading collection statistics from {STATS_FILE}...")
+        stats = load_index_stats(STATS_FILE)
+        df = stats["zipf"]
+    else:
+        print("Loading CSV data...")
+        df = pd.read_csv("zipf_data.csv")
     
     df_head = df.head(10000).copy()
     
@@ -34,8 +132,10 @@ def main():
     
     output_img = "lab4_zipf_plot.png"
     plt.savefig(output_img)
-    plt.show()
     print(f"Graph saved to {output_img}")
+    if stats is not None:
+        plot_collection_stats(stats)
+    plt.show()
     
     print("\n--- Statistics for Report ---")
     print(f"Most frequent word (Rank 1): {df['word'].iloc[0]} ({df['frequency'].iloc[0]})")
@@ -45,6 +145,8 @@ def main():
     single_use_count = len(df[df['frequency'] == 1])
     print(f"Words appearing only once (Hapax Legomena): {single_use_count}")
     print(f"Percentage of dictionary: {single_use_count / len(df) * 100:.2f}%")
+    if stats is not None:
+        print(f"Documents: {stats['docs']}, tokens: {stats['tokens']}")
 
 if __name__ == "__main__":
     main()
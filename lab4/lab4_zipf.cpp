@@ -3,141 +3,282 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <string_view>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <cstring>
+
+#include "../common/case_fold.h"
+#include "../common/corpus_reader.h"
+#include "../common/term_vocabulary.h"
+#include "../common/tokenizer.h"
 
 const std::string INPUT_FILE = "../data/corpus_final.txt";
 const std::string OUTPUT_CSV = "zipf_data.csv";
+const size_t CORPUS_CHUNK = 4 << 20;
+const int CMS_DEPTH = 4;
 
-void to_lower_string(std::string &str) {
-    for (size_t i = 0; i < str.size(); ++i) {
-        unsigned char c = static_cast<unsigned char>(str[i]);
-        if (c >= 'A' && c <= 'Z') str[i] = c + 32;
-        if (c == 0xD0 && i + 1 < str.size()) {
-            unsigned char next = static_cast<unsigned char>(str[i+1]);
-            if (next >= 0x90 && next <= 0xAF) {
-                if (next <= 0x9F) str[i+1] = next + 0x20; 
-                else { str[i] = 0xD1; str[i+1] = next - 0x20; }
-            }
-        }
+// Exact counts: every distinct token is interned once into the table's
+// arena and counted by dense id, instead of keeping the whole token stream.
+class ExactCounter {
+private:
+    TermVocabulary vocab;
+    std::vector<uint64_t> counts;
+
+public:
+    void add(std::string_view token, uint64_t n = 1) {
+        uint32_t id = vocab.intern(token);
+        if (id == counts.size()) counts.push_back(0);
+        counts[id] += n;
     }
-}
 
-bool is_alphanum(unsigned char c) {
-    if (isalnum(c)) return true;
-    if (c > 127) return true;
-    return false;
-}
+    void merge(const ExactCounter& other) {
+        for (uint32_t id = 0; id < other.vocab.size(); ++id) add(other.vocab.term(id), other.counts[id]);
+    }
 
-int main() {
-    std::vector<std::string> all_tokens;
-    all_tokens.reserve(10000000); 
+    std::vector<std::pair<std::string_view, uint64_t>> entries() const {
+        std::vector<std::pair<std::string_view, uint64_t>> out;
+        out.reserve(counts.size());
+        for (uint32_t id = 0; id < vocab.size(); ++id) out.push_back({vocab.term(id), counts[id]});
+        return out;
+    }
 
-    std::ifstream file(INPUT_FILE);
-    if (!file.is_open()) {
-        std::cerr << "Error opening input file!" << std::endl;
-        return 1;
+    size_t memory_bytes() const { return vocab.memory_bytes() + counts.capacity() * sizeof(uint64_t); }
+};
+
+// Count-Min Sketch: CMS_DEPTH rows of `width` counters. An estimate never
+// undercounts and overcounts by at most e * total / width with high
+// probability, whatever the number of distinct tokens.
+class CountMinSketch {
+private:
+    size_t width;
+    std::vector<uint32_t> cells;
+
+    size_t cell(uint64_t h, int row) const {
+        uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+        return row * width + (h1 + (uint64_t)row * h2) % width;
     }
 
-    std::cout << "Reading tokens..." << std::endl;
-    std::string line;
-    long long total_processed = 0;
-
-    while (std::getline(file, line)) {
-        if (line.empty()) continue;
-        
-        size_t tab1 = line.find('\t');
-        if (tab1 == std::string::npos) continue;
-        size_t tab2 = line.find('\t', tab1 + 1);
-        if (tab2 == std::string::npos) continue;
-        
-        std::string current_token;
-        size_t start_pos = tab2 + 1;
-        size_t len = line.size();
-
-        for (size_t i = start_pos; i < len; ++i) {
-            unsigned char c = line[i];
-            bool is_char_part_of_word = false;
-
-            if (is_alphanum(c)) {
-                is_char_part_of_word = true;
-            } else {
-                bool has_prev = (i > start_pos);
-                bool has_next = (i + 1 < len);
-
-                if (c == '.') {
-                    if (has_prev && has_next && is_alphanum(line[i-1]) && is_alphanum(line[i+1])) is_char_part_of_word = true;
-                }
-                else if (c == '-' || c == '+') {
-                    if (c == '+' && has_prev && (is_alphanum(line[i-1]) || line[i-1] == '+')) is_char_part_of_word = true;
-                    else if (c == '-' && has_prev && has_next && is_alphanum(line[i-1]) && is_alphanum(line[i+1])) is_char_part_of_word = true;
-                }
-                else if (c == '_') {
-                     if (has_prev && has_next && is_alphanum(line[i-1]) && is_alphanum(line[i+1])) is_char_part_of_word = true;
-                }
-            }
+public:
+    explicit CountMinSketch(size_t w) : width(w), cells(w * CMS_DEPTH, 0) {}
 
-            if (is_char_part_of_word) {
-                current_token += c;
-            } else {
-                if (!current_token.empty()) {
-                    to_lower_string(current_token);
-                    all_tokens.push_back(current_token);
-                    current_token.clear();
-                }
-            }
+    uint64_t add(uint64_t h) {
+        uint32_t est = UINT32_MAX;
+        for (int r = 0; r < CMS_DEPTH; ++r) {
+            uint32_t& c = cells[cell(h, r)];
+            if (c < UINT32_MAX) c++;
+            est = std::min(est, c);
         }
-        if (!current_token.empty()) {
-            to_lower_string(current_token);
-            all_tokens.push_back(current_token);
+        return est;
+    }
+
+    uint64_t estimate(uint64_t h) const {
+        uint32_t est = UINT32_MAX;
+        for (int r = 0; r < CMS_DEPTH; ++r) est = std::min(est, cells[cell(h, r)]);
+        return est;
+    }
+
+    void merge(const CountMinSketch& other) {
+        for (size_t i = 0; i < cells.size(); ++i) {
+            uint64_t sum = (uint64_t)cells[i] + other.cells[i];
+            cells[i] = (uint32_t)std::min<uint64_t>(sum, UINT32_MAX);
         }
+    }
 
-        total_processed++;
-        if (total_processed % 1000 == 0) std::cout << "\rDocs processed: " << total_processed << std::flush;
-    }
-    file.close();
-
-    std::cout << "\nTotal raw tokens: " << all_tokens.size() << std::endl;
-    std::cout << "Sorting tokens alphabetically..." << std::endl;
-    std::sort(all_tokens.begin(), all_tokens.end());
-
-    std::cout << "Counting frequencies..." << std::endl;
-    std::vector<std::pair<std::string, int>> sorted_vocab;
-    if (!all_tokens.empty()) {
-        int count = 1;
-        for (size_t i = 1; i < all_tokens.size(); ++i) {
-            if (all_tokens[i] == all_tokens[i-1]) {
-                count++;
-            } else {
-                sorted_vocab.push_back({all_tokens[i-1], count});
-                count = 1;
-            }
+    size_t memory_bytes() const { return cells.size() * sizeof(uint32_t); }
+};
+
+// Approximate top-K: the sketch counts every token, and only tokens whose
+// estimate reaches the current K-th best are kept as candidates. The
+// candidate set is cut back to K whenever it reaches 2K entries.
+class TopKCounter {
+private:
+    size_t k;
+    CountMinSketch sketch;
+    std::unordered_map<std::string, uint64_t> candidates;
+    uint64_t floor = 0;
+    std::string key;
+
+    void prune() {
+        std::vector<std::pair<std::string, uint64_t>> best(candidates.begin(), candidates.end());
+        sort_by_count(best);
+        best.resize(std::min(best.size(), k));
+        floor = best.empty() ? 0 : best.back().second;
+        candidates.clear();
+        candidates.insert(best.begin(), best.end());
+    }
+
+public:
+    TopKCounter(size_t top_k, size_t width) : k(top_k), sketch(width) {}
+
+    template <typename Pairs>
+    static void sort_by_count(Pairs& v) {
+        std::sort(v.begin(), v.end(), [](const auto& a, const auto& b) {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+    }
+
+    void add(std::string_view token) {
+        uint64_t est = sketch.add(hash_term(token));
+        if (est < floor) return;
+
+        key.assign(token.data(), token.size());
+        auto it = candidates.find(key);
+        if (it != candidates.end()) {
+            it->second = est;
+            return;
         }
-        sorted_vocab.push_back({all_tokens.back(), count});
+        candidates.emplace(key, est);
+        if (candidates.size() >= 2 * k) prune();
     }
 
-    std::vector<std::string>().swap(all_tokens);
+    void merge(const TopKCounter& other) {
+        sketch.merge(other.sketch);
+        for (const auto& c : other.candidates) candidates.emplace(c.first, 0);
+        for (auto& c : candidates) c.second = sketch.estimate(hash_term(c.first));
+        prune();
+    }
 
-    std::cout << "Unique terms: " << sorted_vocab.size() << std::endl;
-    std::cout << "Sorting by frequency..." << std::endl;
+    std::vector<std::pair<std::string_view, uint64_t>> entries() const {
+        std::vector<std::pair<std::string_view, uint64_t>> out(candidates.begin(), candidates.end());
+        sort_by_count(out);
+        return out;
+    }
+
+    size_t memory_bytes() const { return sketch.memory_bytes() + candidates.size() * (sizeof(std::string) + 16); }
+};
 
-    std::sort(sorted_vocab.begin(), sorted_vocab.end(), 
-        [](const std::pair<std::string, int>& a, const std::pair<std::string, int>& b) {
-            return a.second > b.second; 
+// Each thread pulls line-aligned blocks from the shared reader and counts
+// them into its own counter; the counters are merged once at the end.
+template <typename Counter>
+void count_corpus(CorpusReader& corpus, std::vector<std::unique_ptr<Counter>>& counters) {
+    std::mutex mtx;
+    long long docs_done = 0;
+
+    auto worker = [&](Counter& counter) {
+        std::string owned, text;
+        std::string_view block;
+        CorpusDoc doc;
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (!corpus.next_block(CORPUS_CHUNK, block)) return;
+                if (!corpus.is_mapped()) {
+                    owned.assign(block.data(), block.size());
+                    block = owned;
+                }
+            }
+
+            long long docs = 0;
+            while (!block.empty()) {
+                const char* eol = (const char*)memchr(block.data(), '\n', block.size());
+                size_t line_len = eol ? eol - block.data() : block.size();
+                std::string_view line = block.substr(0, line_len);
+                block.remove_prefix(std::min(line_len + 1, block.size()));
+                if (line.empty() || !parse_corpus_line(line, doc)) continue;
+
+                text.assign(doc.body.data(), doc.body.size());
+                to_lower_string(text);
+                for_each_token(text, [&counter](std::string_view t) { counter.add(t); });
+                docs++;
+            }
+
+            std::lock_guard<std::mutex> lock(mtx);
+            docs_done += docs;
+            std::cout << "\rDocs processed: " << docs_done << std::flush;
         }
-    );
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < counters.size(); ++t) threads.emplace_back(worker, std::ref(*counters[t]));
+    worker(*counters[0]);
+    for (auto& th : threads) th.join();
 
+    for (size_t t = 1; t < counters.size(); ++t) {
+        counters[0]->merge(*counters[t]);
+        counters[t].reset();
+    }
+}
+
+void save_csv(const std::vector<std::pair<std::string_view, uint64_t>>& sorted_vocab) {
     std::cout << "Saving " << OUTPUT_CSV << "..." << std::endl;
     std::ofstream out(OUTPUT_CSV);
     out << "rank,word,frequency\n";
-    
+
     long long rank = 1;
     for (const auto& pair : sorted_vocab) {
-        std::string word = pair.first;
+        std::string word(pair.first);
         if (word.find(',') != std::string::npos) word = "\"" + word + "\"";
-        
+
         out << rank << "," << word << "," << pair.second << "\n";
         rank++;
     }
-    
+}
+
+int main(int argc, char* argv[]) {
+    unsigned threads = 1;
+    size_t top_k = 0;
+    size_t cms_width = 1 << 18;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            threads = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--top-k" && i + 1 < argc) {
+            top_k = std::stoul(argv[++i]);
+        } else if (arg == "--cms-width" && i + 1 < argc) {
+            cms_width = std::max(1ul, std::stoul(argv[++i]));
+        } else {
+            std::cout << "Usage: ./zipf [--threads N] [--top-k K [--cms-width W]]\n";
+            std::cout << "  --top-k K  approximate top K terms with a Count-Min Sketch (" << CMS_DEPTH
+                      << " x W counters) instead of exact counts\n";
+            return 1;
+        }
+    }
+
+    CorpusReader corpus;
+    if (!corpus.open(INPUT_FILE)) {
+        std::cerr << "Error opening input file!" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Counting tokens..." << std::endl;
+
+    if (top_k > 0) {
+        std::vector<std::unique_ptr<TopKCounter>> counters;
+        for (unsigned t = 0; t < threads; ++t) counters.push_back(std::make_unique<TopKCounter>(top_k, cms_width));
+        count_corpus(corpus, counters);
+        corpus.close();
+
+        std::cout << "\nCounter memory: " << counters[0]->memory_bytes() / 1024 << " KB per thread" << std::endl;
+        save_csv(counters[0]->entries());
+        std::cout << "Done!" << std::endl;
+        return 0;
+    }
+
+    std::vector<std::unique_ptr<ExactCounter>> counters;
+    for (unsigned t = 0; t < threads; ++t) counters.push_back(std::make_unique<ExactCounter>());
+    count_corpus(corpus, counters);
+    corpus.close();
+
+    // Same order as counting a sorted token list: terms in lexical order,
+    // then by frequency.
+    std::vector<std::pair<std::string_view, uint64_t>> sorted_vocab = counters[0]->entries();
+    std::sort(sorted_vocab.begin(), sorted_vocab.end());
+
+    std::cout << "\nUnique terms: " << sorted_vocab.size() << std::endl;
+    std::cout << "Counter memory: " << counters[0]->memory_bytes() / 1024 << " KB" << std::endl;
+    std::cout << "Sorting by frequency..." << std::endl;
+
+    std::sort(sorted_vocab.begin(), sorted_vocab.end(),
+        [](const std::pair<std::string_view, uint64_t>& a, const std::pair<std::string_view, uint64_t>& b) {
+            return a.second > b.second;
+        }
+    );
+
+    save_csv(sorted_vocab);
     std::cout << "Done!" << std::endl;
     return 0;
 }
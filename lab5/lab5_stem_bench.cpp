@@ -0,0 +1,132 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <string_view>
+
+#include "../common/case_fold.h"
+#include "../common/corpus_reader.h"
+#include "../common/stem_cache.h"
+#include "../common/stemmer.h"
+#include "../common/tokenizer.h"
+
+// Micro-benchmark: the trie stemmer (common/stemmer.h), with and without the
+// memo table (common/stem_cache.h), against the previous ends_with() loop,
+// over the first MAX_BENCH_TOKENS corpus tokens.
+
+const std::string INPUT_FILE = "../data/corpus_final.txt";
+const size_t MAX_BENCH_TOKENS = 2000000;
+const double MIN_BENCH_SECONDS = 0.5;
+
+// The stemmer lab5 used before common/stemmer.h: first matching suffix in
+// list order, one std::string per call.
+bool ends_with(const std::string& word, const std::string& suffix) {
+    if (word.length() < suffix.length()) return false;
+    return word.compare(word.length() - suffix.length(), suffix.length(), suffix) == 0;
+}
+
+std::string legacy_stem_word(std::string word) {
+    to_lower_string(word);
+    
+    if (word.size() <= 4) return word; 
+
+    static const std::vector<std::string> ru_suffixes = {
+        "вшимися", "вшими", "вшем", "вшего", "вшая", "вшие", "вшую", "вшим",
+        "щимися", "щими", "вше", "вши",
+        "иеся", "аяся", "оеся", "ыеся", "имися", "ымися",
+        "ившийся", "ывшийся", "ившись", "ывшись",
+        "уюся", "ююся", "авше", "авши", "евше", "евши",
+        "ившая", "ывшая", "ившее", "ывшее", "ившие", "ывшие",
+        "ивший", "ывший", "ившую", "ывшую", "ившим", "ывшим",
+        "ующая", "юющая", "ующее", "юющее", "ующие", "юющие",
+        "ующий", "юющий", "ующую", "юющую", "ующим", "юющим",
+        "авшем", "авшего", "авшую", "авшим", "евшем", "евшего", "евшую", "евшим",
+        "ки", "ие", "ые", "ое", "ий", "ый", "ой", "ей", "уй", "ая", "яя", "ою", "ею",
+        "ями", "ами", "ье", "иям", "иях", "ием", "иев", "ей", "ям", "ем", "ам", "ом", 
+        "ах", "ях", "ых", "их", "ов", "ев", "ью",
+        "ешь", "ете", "ишь", "ите", "ят", "ут", "ют", "ит", "ет", "ть", "ти", "л", "ла", "ло", "ли",
+        "а", "е", "и", "о", "у", "ы", "э", "ю", "я", "й", "ь"
+    };
+
+    for (const auto& suffix : ru_suffixes) {
+        if (ends_with(word, suffix)) {
+            if (word.length() - suffix.length() >= 3) { 
+                return word.substr(0, word.length() - suffix.length());
+            }
+        }
+    }
+
+    static const std::vector<std::string> en_suffixes = {
+        "ational", "tional", "enci", "anci", "izer", "bli", "alli", "entli", "eli", "ousli", 
+        "ization", "ation", "ator", "alism", "iveness", "fulness", "ousness", "aliti", "iviti", "biliti", 
+        "logi", "icate", "ative", "alize", "iciti", "ical", "ful", "ness", 
+        "ing", "ed", "es", "ly", "s"
+    };
+
+    for (const auto& suffix : en_suffixes) {
+        if (ends_with(word, suffix)) {
+             if (word.length() - suffix.length() >= 3) { 
+                return word.substr(0, word.length() - suffix.length());
+            }
+        }
+    }
+
+    return word;
+}
+
+// Keeps the stemmed lengths observable so the calls are not optimized out.
+volatile size_t bench_sink = 0;
+
+template <typename F>
+double tokens_per_second(const std::vector<std::string>& tokens, F&& stem_one) {
+    int rounds = 0;
+    double elapsed = 0;
+    size_t checksum = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    while (elapsed < MIN_BENCH_SECONDS || rounds == 0) {
+        for (const std::string& t : tokens) checksum += stem_one(t);
+        rounds++;
+        elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+    bench_sink = checksum;
+    return (double)tokens.size() * rounds / elapsed;
+}
+
+int main() {
+    CorpusReader corpus;
+    if (!corpus.open(INPUT_FILE)) {
+        std::cerr << "Error opening corpus!\n";
+        return 1;
+    }
+
+    std::vector<std::string> tokens;
+    CorpusDoc doc;
+    std::string text;
+    while (tokens.size() < MAX_BENCH_TOKENS && corpus.next(doc)) {
+        text.assign(doc.body.data(), doc.body.size());
+        to_lower_string(text);
+        for_each_token(text, [&tokens](std::string_view t) { tokens.emplace_back(t); });
+    }
+    if (tokens.size() > MAX_BENCH_TOKENS) tokens.resize(MAX_BENCH_TOKENS);
+    std::cout << "Tokens: " << tokens.size() << "\n\n";
+
+    size_t differ = 0;
+    for (const std::string& t : tokens) {
+        if (legacy_stem_word(t) != stem(t)) differ++;
+    }
+
+    double legacy = tokens_per_second(tokens, [](const std::string& t) { return legacy_stem_word(t).size(); });
+    double trie = tokens_per_second(tokens, [](const std::string& t) { return stem_length(t); });
+    StemCache cache;
+    double memo = tokens_per_second(tokens, [&cache](const std::string& t) { return cache.stem_length(t); });
+
+    std::cout << "stemmer\tMtokens/s\n";
+    std::cout << "legacy\t" << legacy / 1e6 << "\n";
+    std::cout << "trie\t" << trie / 1e6 << "\n";
+    std::cout << "memo\t" << memo / 1e6 << "\n";
+    std::cout << "\nSpeedup: " << trie / legacy << "x (trie), " << memo / legacy << "x (memo)\n";
+    std::cout << "Memo hit rate: " << cache.hit_rate() * 100 << "% (" << cache.uncached()
+              << " lookups too long to cache, " << cache.memory_bytes() / 1024 << " KB)\n";
+    std::cout << "Different stems (longest match instead of first match): " << differ << " of " << tokens.size() << "\n";
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstring>
+
+#include "../common/index_format.h"
+#include "../common/mapped_file.h"
+#include "../common/postings_codec.h"
+
+const std::string INVERTED_INDEX_FILE = "../data/index.bin";
+const double MIN_BENCH_SECONDS = 0.5;
+
+struct EncodedList {
+    uint64_t offset;
+    uint32_t count;
+};
+
+int main() {
+    MappedFile idx;
+    if (!idx.open(INVERTED_INDEX_FILE)) { std::cerr << "No index.bin, run the indexer first!\n"; return 1; }
+
+    const IndexHeader* hdr = (const IndexHeader*)idx.data();
+    if (idx.size() < sizeof(IndexHeader) || hdr->magic != INDEX_MAGIC || hdr->version != INDEX_VERSION) {
+        std::cerr << "Unsupported index.bin format\n";
+        return 1;
+    }
+    if (!index_layout_valid(idx.data(), idx.size())) {
+        std::cerr << "index.bin is truncated or corrupt\n";
+        return 1;
+    }
+
+    const DictEntry* dict = (const DictEntry*)(idx.data() + hdr->dict_offset);
+    const char* postings = idx.data() + hdr->postings_offset;
+
+    std::cout << "Loading " << hdr->num_terms << " postings lists (stored as "
+              << codec_name(hdr->codec) << ")..." << std::endl;
+
+    std::vector<uint32_t> all_docs;
+    std::vector<EncodedList> lists(hdr->num_terms);
+    for (uint32_t t = 0; t < hdr->num_terms; ++t) {
+        lists[t] = {all_docs.size(), dict[t].doc_freq};
+        all_docs.resize(all_docs.size() + dict[t].doc_freq);
+        decode_postings(postings + dict[t].postings_offset, dict[t].doc_freq, dict[t].codec,
+                        all_docs.data() + lists[t].offset);
+    }
+
+    std::cout << "Total postings: " << all_docs.size() << "\n\n";
+    std::cout << "codec\tsize_MB\tbits/posting\tdecode_Mpostings/s\n";
+
+    std::vector<uint32_t> out(all_docs.size());
+
+    for (uint16_t codec : {CODEC_RAW, CODEC_VBYTE, CODEC_BP128}) {
+        std::vector<char> buffer;
+        std::vector<uint64_t> offsets(lists.size());
+        for (size_t t = 0; t < lists.size(); ++t) {
+            offsets[t] = buffer.size();
+            encode_postings(all_docs.data() + lists[t].offset, lists[t].count, codec, buffer);
+        }
+
+        int rounds = 0;
+        double elapsed = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        while (elapsed < MIN_BENCH_SECONDS || rounds == 0) {
+            for (size_t t = 0; t < lists.size(); ++t) {
+                decode_postings(buffer.data() + offsets[t], lists[t].count, codec, out.data() + lists[t].offset);
+            }
+            rounds++;
+            elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+
+        if (out != all_docs) {
+            std::cerr << "Decode mismatch for codec " << codec_name(codec) << "\n";
+            return 1;
+        }
+
+        double mpostings = (double)all_docs.size() * rounds / elapsed / 1e6;
+        double bits = all_docs.empty() ? 0 : buffer.size() * 8.0 / all_docs.size();
+        std::cout << codec_name(codec) << "\t" << buffer.size() / (1024.0 * 1024.0) << "\t" << bits
+                  << "\t" << mpostings << "\n";
+    }
+
+    return 0;
+}
@@ -5,68 +5,469 @@
 #include <algorithm>
 #include <cstring>
 #include <chrono>
+#include <queue>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <unordered_set>
+#include <cstdio>
+#include <cerrno>
+#include <sys/stat.h>
 
-const std::string INPUT_FILE = "../data/corpus_final.txt";
-const std::string FORWARD_INDEX_FILE = "../data/docs.bin";
-const std::string INVERTED_INDEX_FILE = "../data/index.bin";
-
-bool is_alphanum(unsigned char c) {
-    if (isalnum(c)) return true;
-    if (c > 127) return true; 
-    return false;
-}
-
-void to_lower_string(std::string &str) {
-    for (size_t i = 0; i < str.size(); ++i) {
-        unsigned char c = static_cast<unsigned char>(str[i]);
-        if (c >= 'A' && c <= 'Z') str[i] = c + 32;
-        if (c == 0xD0 && i + 1 < str.size()) {
-            unsigned char next = static_cast<unsigned char>(str[i+1]);
-            if (next >= 0x90 && next <= 0xAF) {
-                if (next <= 0x9F) str[i+1] = next + 0x20; 
-                else { str[i] = 0xD1; str[i+1] = next - 0x20; }
+#include "../common/case_fold.h"
+#include "../common/frequencies_codec.h"
+#include "../common/collection_stats.h"
+#include "../common/corpus_reader.h"
+#include "../common/index_format.h"
+#include "../common/mapped_file.h"
+#include "../common/positions_codec.h"
+#include "../common/postings_codec.h"
+#include "../common/shard_manifest.h"
+#include "../common/stemmer.h"
+#include "../common/term_vocabulary.h"
+#include "../common/tokenizer.h"
+
+const std::string DATA_DIR = "../data/";
+const std::string INPUT_FILE = DATA_DIR + "corpus_final.txt";
+// Output files, in DATA_DIR or, for a sharded index, in each shard's
+// directory under it.
+const std::string FORWARD_INDEX_FILE = "docs.bin";
+const std::string INVERTED_INDEX_FILE = "index.bin";
+const std::string STEM_INDEX_FILE = "index_stem.bin";
+const std::string RUN_FILE_PREFIX = "index_run_";
+const std::string STATS_FILE = "index_stats.bin";
+const std::string SHARD_DIR_PREFIX = "shard_";
+// In each shard's directory: which part of which corpus it was cut from.
+const std::string SHARD_INFO_FILE = "shard.info";
+const std::string SEGMENT_DIR_PREFIX = "seg_";
+const uint32_t SEGMENT_MERGE_FACTOR = 4;
+const size_t COPY_CHUNK = 1 << 20;
+// Whatever the per-doc and per-term tables take, buffered postings may
+// grow to at least this part of --mem-mb before they are spilled.
+const size_t MIN_POSTINGS_BUDGET_SHARE = 8;
+const size_t CORPUS_CHUNK = 4 << 20;
+
+// Pads `out` with zeros up to `offset`, then writes the section there.
+void write_section(std::ofstream& out, const char* data, size_t size, uint64_t offset) {
+    static const char zeros[8] = {0};
+    uint64_t pos = out.tellp();
+    out.write(zeros, offset - pos);
+    out.write(data, size);
+}
+
+// Appends the whole file at `path` to `out` and deletes it.
+void append_and_remove(std::ofstream& out, const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::vector<char> chunk(COPY_CHUNK);
+    while (in.read(chunk.data(), chunk.size()) || in.gcount() > 0) {
+        out.write(chunk.data(), in.gcount());
+    }
+    in.close();
+    std::remove(path.c_str());
+}
+
+struct TermEntry {
+    uint32_t term_id;
+    uint32_t doc_id;
+    uint32_t tf;
+};
+
+// Streams (term, postings) pairs in lexical term order into an index file.
+// Encoded postings, frequencies and positions go to temporary files first
+// because the dictionary and strings sections precede them in the final
+// layout.
+class IndexWriter {
+private:
+    std::string path;
+    std::string postings_tmp_path;
+    std::ofstream postings_out;
+    uint64_t postings_size = 0;
+
+    bool with_positions;
+    std::string positions_tmp_path;
+    std::ofstream positions_out;
+    std::vector<uint64_t> term_positions;
+    uint64_t positions_size = 0;
+
+    std::string frequencies_tmp_path;
+    std::ofstream frequencies_out;
+    std::vector<uint64_t> term_frequencies;
+    uint64_t frequencies_size = 0;
+
+    std::vector<DictEntry> dict;
+    std::vector<char> strings_buffer;
+    std::vector<char> encoded;
+
+    uint16_t codec;
+    uint32_t flags;
+    const std::vector<uint32_t>& doc_lengths;
+    uint32_t total_docs;
+    uint64_t total_tokens = 0;
+    double avg_doc_length = 1;
+
+public:
+    uint32_t bitmap_terms = 0;
+
+    IndexWriter(const std::string& index_path, uint16_t postings_codec, uint32_t index_flags,
+                const std::vector<uint32_t>& lengths, bool positions = false)
+        : path(index_path), postings_tmp_path(index_path + ".postings.tmp"), with_positions(positions),
+          positions_tmp_path(index_path + ".positions.tmp"), frequencies_tmp_path(index_path + ".frequencies.tmp"),
+          codec(postings_codec), flags(index_flags | INDEX_FLAG_FREQUENCIES), doc_lengths(lengths),
+          total_docs((uint32_t)lengths.size()) {
+        for (uint32_t len : doc_lengths) total_tokens += len;
+        if (total_docs > 0 && total_tokens > 0) avg_doc_length = (double)total_tokens / total_docs;
+
+        postings_out.open(postings_tmp_path, std::ios::binary);
+        if (!postings_out) { std::cerr << "Error writing " << postings_tmp_path << "\n"; exit(1); }
+        frequencies_out.open(frequencies_tmp_path, std::ios::binary);
+        if (!frequencies_out) { std::cerr << "Error writing " << frequencies_tmp_path << "\n"; exit(1); }
+        if (with_positions) {
+            positions_out.open(positions_tmp_path, std::ios::binary);
+            if (!positions_out) { std::cerr << "Error writing " << positions_tmp_path << "\n"; exit(1); }
+            flags |= INDEX_FLAG_POSITIONS;
+        }
+    }
+
+    // `tfs` are the term's frequencies in the docs. `positions` holds the
+    // docs' position records back to back (positions_codec.h); it is only
+    // read when the writer has positions.
+    void add_term(std::string_view term, const uint32_t* doc_ids, const uint32_t* tfs, size_t count,
+                  const char* positions = nullptr) {
+        DictEntry e{};
+        e.doc_freq = (uint32_t)count;
+        e.codec = codec;
+
+        encoded.clear();
+        encode_postings(doc_ids, count, codec, encoded);
+
+        if (codec != CODEC_RAW && bitmap_words(total_docs) * 8 < encoded.size()) {
+            encoded.clear();
+            encode_bitmap(doc_ids, count, total_docs, encoded);
+            e.codec = CODEC_BITMAP;
+            pad_postings(align8(postings_size));
+            bitmap_terms++;
+        }
+
+        e.postings_offset = postings_size;
+        e.postings_bytes = (uint32_t)encoded.size();
+        postings_out.write(encoded.data(), encoded.size());
+        postings_size += encoded.size();
+
+        size_t t_len = std::min(term.size(), (size_t)255);
+        e.term_offset = (uint32_t)strings_buffer.size();
+        e.term_len = (uint16_t)t_len;
+        strings_buffer.insert(strings_buffer.end(), term.begin(), term.begin() + t_len);
+
+        dict.push_back(e);
+
+        encoded.clear();
+        encode_frequencies(doc_ids, tfs, count, doc_lengths.data(), avg_doc_length, encoded);
+        term_frequencies.push_back(frequencies_size);
+        frequencies_out.write(encoded.data(), encoded.size());
+        frequencies_size += encoded.size();
+
+        if (with_positions) {
+            encoded.clear();
+            encode_positions(doc_ids, count, positions, encoded);
+            term_positions.push_back(positions_size);
+            positions_out.write(encoded.data(), encoded.size());
+            positions_size += encoded.size();
+        }
+    }
+
+    void finish() {
+        postings_out.close();
+        positions_out.close();
+        frequencies_out.close();
+
+        std::ofstream idx_out(path, std::ios::binary);
+        if (!idx_out) { std::cerr << "Error writing " << path << "\n"; exit(1); }
+
+        IndexHeader hdr{};
+        hdr.magic = INDEX_MAGIC;
+        hdr.version = INDEX_VERSION;
+        hdr.num_terms = (uint32_t)dict.size();
+        hdr.codec = codec;
+        hdr.flags = flags;
+        hdr.num_docs = total_docs;
+        hdr.total_tokens = total_tokens;
+        hdr.dict_offset = align8(sizeof(IndexHeader));
+        hdr.strings_offset = align8(hdr.dict_offset + dict.size() * sizeof(DictEntry));
+        hdr.strings_size = strings_buffer.size();
+        hdr.postings_offset = align8(hdr.strings_offset + hdr.strings_size);
+        hdr.postings_size = postings_size;
+        if (with_positions) {
+            hdr.positions_offset = align8(hdr.postings_offset + hdr.postings_size);
+            hdr.positions_size = term_positions.size() * 8 + positions_size;
+        }
+        uint64_t end = with_positions ? hdr.positions_offset + hdr.positions_size : hdr.postings_offset + hdr.postings_size;
+        hdr.frequencies_offset = align8(end);
+        hdr.frequencies_size = term_frequencies.size() * 8 + frequencies_size;
+        hdr.doc_lengths_offset = align8(hdr.frequencies_offset + hdr.frequencies_size);
+
+        write_section(idx_out, (const char*)&hdr, sizeof(hdr), 0);
+        write_section(idx_out, (const char*)dict.data(), dict.size() * sizeof(DictEntry), hdr.dict_offset);
+        write_section(idx_out, strings_buffer.data(), strings_buffer.size(), hdr.strings_offset);
+        write_section(idx_out, nullptr, 0, hdr.postings_offset);
+        append_and_remove(idx_out, postings_tmp_path);
+
+        if (with_positions) {
+            write_section(idx_out, (const char*)term_positions.data(), term_positions.size() * 8, hdr.positions_offset);
+            append_and_remove(idx_out, positions_tmp_path);
+        }
+
+        write_section(idx_out, (const char*)term_frequencies.data(), term_frequencies.size() * 8, hdr.frequencies_offset);
+        append_and_remove(idx_out, frequencies_tmp_path);
+        write_section(idx_out, (const char*)doc_lengths.data(), doc_lengths.size() * 4, hdr.doc_lengths_offset);
+
+        idx_out.close();
+    }
+
+    uint32_t num_terms() const { return (uint32_t)dict.size(); }
+    uint64_t positions_bytes() const { return positions_size; }
+    uint64_t frequencies_bytes() const { return frequencies_size; }
+
+private:
+    void pad_postings(uint64_t target) {
+        static const char zeros[8] = {0};
+        postings_out.write(zeros, target - postings_size);
+        postings_size = target;
+    }
+
+};
+
+// Second dictionary keyed by stems (stemmer.h), written next to the
+// index.bin in `dir`. A stem is a prefix of every term it comes from, so the
+// terms are grouped from the finished index.bin and each group's frequency
+// lists are merged; this costs one decode pass over the index instead of
+// stemming every token while parsing. Returns the number of stems.
+uint32_t build_stem_index(const std::string& dir, uint16_t codec, uint32_t flags,
+                          const std::vector<uint32_t>& doc_lengths) {
+    MappedFile idx;
+    if (!idx.open(dir + INVERTED_INDEX_FILE)) { std::cerr << "Cannot reopen " << dir + INVERTED_INDEX_FILE << "\n"; exit(1); }
+    const IndexHeader* hdr = (const IndexHeader*)idx.data();
+    const DictEntry* dict = (const DictEntry*)(idx.data() + hdr->dict_offset);
+    const char* strings = idx.data() + hdr->strings_offset;
+    const uint64_t* term_frequencies = (const uint64_t*)(idx.data() + hdr->frequencies_offset);
+    const char* frequencies = (const char*)(term_frequencies + hdr->num_terms);
+
+    std::vector<std::pair<std::string_view, uint32_t>> by_stem(hdr->num_terms);
+    for (uint32_t t = 0; t < hdr->num_terms; ++t) {
+        by_stem[t] = {stem(std::string_view(strings + dict[t].term_offset, dict[t].term_len)), t};
+    }
+    std::stable_sort(by_stem.begin(), by_stem.end(),
+                     [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    IndexWriter writer(dir + STEM_INDEX_FILE, codec, flags | INDEX_FLAG_STEMMED, doc_lengths);
+    std::vector<std::pair<uint32_t, uint32_t>> merged;
+    std::vector<uint32_t> doc_ids, tfs;
+    for (size_t i = 0; i < by_stem.size();) {
+        size_t j = i;
+        merged.clear();
+        for (; j < by_stem.size() && by_stem[j].first == by_stem[i].first; ++j) {
+            uint32_t t = by_stem[j].second;
+            for (FreqCursor c(frequencies + term_frequencies[t], dict[t].doc_freq); !c.at_end(); c.next()) {
+                merged.push_back({c.doc(), c.tf()});
+            }
+        }
+        if (j - i > 1) std::sort(merged.begin(), merged.end());
+
+        // A doc holding several surface forms of the stem gets the sum
+        // of their tfs.
+        doc_ids.clear();
+        tfs.clear();
+        for (const auto& [doc, tf] : merged) {
+            if (!doc_ids.empty() && doc_ids.back() == doc) {
+                tfs.back() += tf;
+            } else {
+                doc_ids.push_back(doc);
+                tfs.push_back(tf);
             }
         }
+        writer.add_term(by_stem[i].first, doc_ids.data(), tfs.data(), doc_ids.size());
+        i = j;
     }
+
+    writer.finish();
+    return writer.num_terms();
 }
 
-struct TermEntry {
+// Sequential reader of a spilled run: groups of
+// [u16 term_len][term][u32 count][count x u32 doc_id][count x u32 tf],
+// sorted by term, each followed by [u64 size][position records] in a
+// positional index.
+struct RunReader {
+    std::ifstream in;
     std::string term;
-    uint32_t doc_id;
+    std::vector<uint32_t> doc_ids;
+    std::vector<uint32_t> tfs;
+    std::vector<char> positions;
+    bool with_positions;
+    bool valid = false;
+
+    RunReader(const std::string& path, bool positions_in_run) : in(path, std::ios::binary), with_positions(positions_in_run) {
+        read_next();
+    }
 
-    bool operator<(const TermEntry& other) const {
-        if (term != other.term) {
-            return term < other.term;
+    void read_next() {
+        uint16_t t_len;
+        uint32_t count;
+        valid = false;
+        if (!in.read((char*)&t_len, 2)) return;
+        term.resize(t_len);
+        in.read(&term[0], t_len);
+        in.read((char*)&count, 4);
+        doc_ids.resize(count);
+        in.read((char*)doc_ids.data(), (size_t)count * 4);
+        tfs.resize(count);
+        in.read((char*)tfs.data(), (size_t)count * 4);
+        if (with_positions) {
+            uint64_t size = 0;
+            in.read((char*)&size, 8);
+            positions.resize(size);
+            in.read(positions.data(), size);
         }
-        return doc_id < other.doc_id;
+        valid = (bool)in;
     }
 };
 
+// A line-aligned slice of the corpus and what a worker extracted from it.
+// Doc ids in a result are local to the chunk and term ids index into
+// result.terms; both are rebased when the chunk is committed in order.
+// A chunk is a view into the mapped corpus; only a streamed corpus, whose
+// buffer is reused by the reader, is copied into `owned`.
+struct CorpusChunk {
+    uint64_t seq = 0;
+    std::string_view view;
+    std::string owned;
+
+    std::string_view data() const { return owned.empty() ? view : std::string_view(owned); }
+};
+
+struct ChunkResult {
+    uint64_t seq = 0;
+    uint32_t num_docs = 0;
+    size_t text_bytes = 0;
+    std::string docs_data;
+    std::vector<uint64_t> doc_offsets;
+    std::vector<std::string_view> terms;
+    std::vector<uint32_t> term_counts;
+    std::vector<uint32_t> term_first_token;
+    std::vector<uint32_t> doc_lengths;
+    uint64_t num_tokens = 0;
+    std::vector<TermEntry> entries;
+    std::vector<uint64_t> entry_positions; // offset of each entry's record in `positions`
+    std::vector<char> positions;
+};
+
+// Per-thread tokenization state. Term bytes live in the thread's own
+// vocabulary arena, which outlives every ChunkResult pointing into it.
+struct WorkerState {
+    TermVocabulary vocab;
+    std::vector<uint64_t> last_doc_seen;
+    std::vector<uint64_t> chunk_seen;
+    std::vector<uint32_t> chunk_local_id;
+    std::vector<uint32_t> doc_entry;
+    uint64_t doc_stamp = 0;
+    bool fold_yo = false;
+    std::string text;
+
+    // Positions of the current doc as (entry - doc_first_entry, position).
+    bool positions = false;
+    uint64_t doc_first_token = 0;
+    size_t doc_first_entry = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> doc_positions;
+    std::vector<uint32_t> entry_start;
+    std::vector<uint32_t> sorted_positions;
+};
+
 class Indexer {
 private:
     std::vector<TermEntry> entries; 
+    TermVocabulary vocab;
     uint32_t total_docs = 0;
+    unsigned num_threads;
+    uint16_t codec;
+    bool fold_yo;
+    bool build_stems;
+    bool with_positions;
+    uint64_t positions_bytes = 0;
+    uint64_t frequencies_bytes = 0;
+    uint32_t bitmap_terms = 0;
+    uint32_t unique_terms = 0;
+    uint32_t unique_stems = 0;
+
+    size_t memory_budget;
+    std::vector<std::string> run_files;
+
+    // What is indexed, where the files go and which corpus bytes are
+    // indexed (a shard's).
+    std::string input_path = INPUT_FILE;
+    std::string out_dir = DATA_DIR;
+    size_t corpus_begin = 0;
+    size_t corpus_end = SIZE_MAX;
     
-    size_t total_term_len_sum = 0;
     size_t corpus_text_bytes = 0;
 
+    // Collection statistics, indexed by global term id.
+    std::vector<uint64_t> coll_freq;
+    std::vector<uint32_t> doc_freq;
+    std::vector<uint32_t> doc_lengths;
+    uint64_t total_tokens = 0;
+    std::vector<HeapsPoint> heaps_points;
+    uint64_t next_heaps_vocab = 1;
+    std::vector<uint64_t> doc_length_hist = std::vector<uint64_t>(STATS_HIST_BUCKETS, 0);
+
+    // Urls and titles go to docs.bin's temp data file as chunks are
+    // committed; only their offsets stay in memory.
+    std::vector<uint64_t> doc_offsets;
+    std::ofstream docs_data_out;
+    uint64_t docs_data_size = 0;
+
+    // Position records of `entries`, parallel to it, when with_positions.
+    std::vector<uint64_t> entry_positions;
+    std::vector<char> positions_data;
+
 public:
+    Indexer(uint16_t postings_codec, size_t mem_budget_bytes, unsigned threads, bool fold_yo_to_ye, bool stems, bool positions)
+        : num_threads(threads), codec(postings_codec), fold_yo(fold_yo_to_ye), build_stems(stems), with_positions(positions),
+          memory_budget(mem_budget_bytes) {}
+
+    // Indexes only the corpus lines starting in [begin, end) into `dir`,
+    // with doc ids from 0.
+    void set_shard(const std::string& dir, size_t begin, size_t end) {
+        out_dir = dir;
+        corpus_begin = begin;
+        corpus_end = end;
+    }
+
+    void set_input(const std::string& path) { input_path = path; }
+
+    uint32_t num_docs() const { return total_docs; }
+
     void run() {
         auto start_time = std::chrono::high_resolution_clock::now();
 
         std::cout << "Phase 1: Parsing Corpus and Building Forward Index..." << std::endl;
         build_forward_index_and_collect_terms();
 
-        std::cout << "Phase 2: Sorting " << entries.size() << " index entries..." << std::endl;
-        std::sort(entries.begin(), entries.end());
-        
-        auto last = std::unique(entries.begin(), entries.end(), [](const TermEntry& a, const TermEntry& b){
-            return a.term == b.term && a.doc_id == b.doc_id;
-        });
-        entries.erase(last, entries.end());
+        if (run_files.empty()) {
+            std::cout << "Phase 2-3: Sorting " << entries.size() << " index entries and writing Inverted Index..." << std::endl;
+            write_inverted_index();
+        } else {
+            spill_run();
+            std::cout << "Phase 2-3: Merging " << run_files.size() << " runs into Inverted Index..." << std::endl;
+            merge_runs();
+        }
+        write_collection_stats();
 
-        std::cout << "Phase 3: Writing Inverted Index to disk..." << std::endl;
-        write_inverted_index();
+        if (build_stems) {
+            write_stem_index();
+        } else {
+            std::remove((out_dir + STEM_INDEX_FILE).c_str());
+        }
 
         auto end_time = std::chrono::high_resolution_clock::now();
         std::chrono::duration<double> total_time = end_time - start_time;
@@ -76,52 +477,198 @@ public:
 
 private:
     void build_forward_index_and_collect_terms() {
-        std::ifstream infile(INPUT_FILE);
-        std::ofstream docs_out(FORWARD_INDEX_FILE, std::ios::binary);
-        
-        if (!infile) { std::cerr << "No corpus file!\n"; exit(1); }
-        if (!docs_out) { std::cerr << "Cannot write docs.bin\n"; exit(1); }
+        CorpusReader corpus;
+        if (!corpus.open(input_path)) { std::cerr << "No corpus file!\n"; exit(1); }
+        if ((corpus_begin > 0 || corpus_end != SIZE_MAX) && !corpus.set_range(corpus_begin, corpus_end)) {
+            std::cerr << "Sharding needs a regular corpus file\n";
+            exit(1);
+        }
+        docs_data_out.open(docs_data_path(), std::ios::binary);
+        if (!docs_data_out) { std::cerr << "Cannot write " << docs_data_path() << "\n"; exit(1); }
 
-        std::vector<uint64_t> doc_offsets;
-        
-        uint32_t zero = 0;
-        docs_out.write((char*)&total_docs, sizeof(total_docs)); 
+        if (num_threads <= 1) {
+            WorkerState state;
+            state.fold_yo = fold_yo;
+            state.positions = with_positions;
+            CorpusChunk chunk;
+            for (uint64_t seq = 0; corpus.next_block(CORPUS_CHUNK, chunk.view); ++seq) {
+                chunk.seq = seq;
+                ChunkResult result = process_chunk(state, chunk);
+                commit_chunk(result);
+            }
+        } else {
+            run_pipeline(corpus);
+        }
+        std::cout << "\n";
+
+        write_forward_index();
+    }
+
+    // One reader thread cuts the corpus into chunks, num_threads workers
+    // tokenize them, and this thread commits the results strictly in chunk
+    // order so doc ids come out exactly as in the sequential run.
+    void run_pipeline(CorpusReader& corpus) {
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::vector<CorpusChunk> queue;
+        std::map<uint64_t, ChunkResult> done;
+        bool reader_finished = false;
+        uint64_t chunks_read = 0;
+        uint64_t next_commit = 0;
+        const uint64_t max_in_flight = num_threads * 2;
+
+        std::thread reader([&]() {
+            CorpusChunk chunk;
+            while (corpus.next_block(CORPUS_CHUNK, chunk.view)) {
+                if (!corpus.is_mapped()) chunk.owned.assign(chunk.view.data(), chunk.view.size());
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [&]() { return chunks_read - next_commit < max_in_flight; });
+                chunk.seq = chunks_read++;
+                queue.push_back(std::move(chunk));
+                chunk = CorpusChunk();
+                cv.notify_all();
+            }
+            std::lock_guard<std::mutex> lock(mtx);
+            reader_finished = true;
+            cv.notify_all();
+        });
+
+        std::vector<std::unique_ptr<WorkerState>> states;
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < num_threads; ++t) {
+            states.push_back(std::make_unique<WorkerState>());
+            states.back()->fold_yo = fold_yo;
+            states.back()->positions = with_positions;
+            workers.emplace_back([&, state = states.back().get()]() {
+                while (true) {
+                    CorpusChunk chunk;
+                    {
+                        std::unique_lock<std::mutex> lock(mtx);
+                        cv.wait(lock, [&]() { return !queue.empty() || reader_finished; });
+                        if (queue.empty()) return;
+                        chunk = std::move(queue.front());
+                        queue.erase(queue.begin());
+                    }
+                    ChunkResult result = process_chunk(*state, chunk);
+                    std::lock_guard<std::mutex> lock(mtx);
+                    done.emplace(result.seq, std::move(result));
+                    cv.notify_all();
+                }
+            });
+        }
+
+        while (true) {
+            ChunkResult result;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [&]() {
+                    return done.count(next_commit) || (reader_finished && next_commit == chunks_read);
+                });
+                if (!done.count(next_commit)) break;
+                result = std::move(done[next_commit]);
+                done.erase(next_commit);
+            }
+            commit_chunk(result);
+
+            std::lock_guard<std::mutex> lock(mtx);
+            next_commit++;
+            cv.notify_all();
+        }
+
+        reader.join();
+        for (auto& w : workers) w.join();
+    }
+
+    static ChunkResult process_chunk(WorkerState& state, const CorpusChunk& chunk) {
+        ChunkResult result;
+        result.seq = chunk.seq;
+
+        std::string_view data = chunk.data();
+        CorpusDoc doc;
+        while (!data.empty()) {
+            const char* eol = (const char*)memchr(data.data(), '\n', data.size());
+            size_t line_len = eol ? eol - data.data() : data.size();
+            std::string_view line = data.substr(0, line_len);
+            data.remove_prefix(std::min(line_len + 1, data.size()));
+
+            if (line.empty() || !parse_corpus_line(line, doc) || !doc.has_text) continue;
+
+            std::string_view url = doc.url;
+            std::string_view title = doc.title;
+
+            result.doc_offsets.push_back(result.docs_data.size());
 
-        std::string docs_data_buffer; 
-        
-        std::string line;
-        while (std::getline(infile, line)) {
-            if (line.empty()) continue;
-            
-            size_t tab1 = line.find('\t');
-            size_t tab2 = line.find('\t', tab1 + 1);
-            size_t tab3 = line.find('\t', tab2 + 1);
-            
-            if (tab3 == std::string::npos) continue;
-
-            std::string url = line.substr(tab1 + 1, tab2 - tab1 - 1);
-            std::string title = line.substr(tab2 + 1, tab3 - tab2 - 1);
-            std::string text = line.substr(tab3 + 1);
-
-            doc_offsets.push_back(docs_data_buffer.size());
-            
             uint16_t u_len = (uint16_t)url.size();
-            docs_data_buffer.append((char*)&u_len, 2);
-            docs_data_buffer.append(url);
-            
+            result.docs_data.append((char*)&u_len, 2);
+            result.docs_data.append(url.data(), u_len);
+
             uint16_t t_len = (uint16_t)title.size();
-            docs_data_buffer.append((char*)&t_len, 2);
-            docs_data_buffer.append(title);
-            
-            corpus_text_bytes += text.size();
-            tokenize_and_add(text, total_docs);
+            result.docs_data.append((char*)&t_len, 2);
+            result.docs_data.append(title.data(), t_len);
 
-            total_docs++;
-            if (total_docs % 2000 == 0) std::cout << "\rProcessed " << total_docs << " docs..." << std::flush;
+            // The corpus itself is read-only: the text is folded in the
+            // worker's buffer, url and title were copied above as-is.
+            state.text.assign(doc.text.data(), doc.text.size());
+            to_lower_string(state.text, state.fold_yo);
+
+            result.text_bytes += doc.text.size();
+            uint64_t tokens_before = result.num_tokens;
+            tokenize_and_add(state, result, state.text, result.num_docs);
+            result.doc_lengths.push_back((uint32_t)(result.num_tokens - tokens_before));
+            result.num_docs++;
         }
-        std::cout << "\n";
+        return result;
+    }
+
+    void commit_chunk(ChunkResult& result) {
+        std::vector<uint32_t> global_id(result.terms.size());
+        for (size_t i = 0; i < result.terms.size(); ++i) {
+            global_id[i] = vocab.intern(result.terms[i]);
+            if (global_id[i] == coll_freq.size()) {
+                coll_freq.push_back(0);
+                doc_freq.push_back(0);
+                record_vocab_growth(total_tokens + result.term_first_token[i] + 1);
+            }
+            coll_freq[global_id[i]] += result.term_counts[i];
+        }
+        total_tokens += result.num_tokens;
+
+        for (const TermEntry& e : result.entries) {
+            entries.push_back({global_id[e.term_id], total_docs + e.doc_id, e.tf});
+            doc_freq[global_id[e.term_id]]++;
+        }
+        for (uint64_t off : result.entry_positions) entry_positions.push_back(positions_data.size() + off);
+        positions_data.insert(positions_data.end(), result.positions.begin(), result.positions.end());
+        for (uint32_t len : result.doc_lengths) doc_length_hist[log2_bucket((uint64_t)len + 1)]++;
+        doc_lengths.insert(doc_lengths.end(), result.doc_lengths.begin(), result.doc_lengths.end());
+
+        for (uint64_t off : result.doc_offsets) doc_offsets.push_back(docs_data_size + off);
+        docs_data_out.write(result.docs_data.data(), result.docs_data.size());
+        docs_data_size += result.docs_data.size();
+
+        uint32_t before = total_docs;
+        total_docs += result.num_docs;
+        corpus_text_bytes += result.text_bytes;
+        if (total_docs / 2000 != before / 2000) std::cout << "\rProcessed " << total_docs << " docs..." << std::flush;
+
+        // The per-doc and per-term tables stay in memory until the end, so
+        // the postings buffer gets what they leave of the budget.
+        size_t entries_bytes = entries.size() * sizeof(TermEntry) + entry_positions.size() * 8 + positions_data.size();
+        size_t resident = doc_offsets.capacity() * 8 + doc_lengths.capacity() * 4 + coll_freq.capacity() * 8 +
+                          doc_freq.capacity() * 4 + vocab.memory_bytes();
+        size_t postings_budget = std::max(memory_budget / MIN_POSTINGS_BUDGET_SHARE,
+                                          memory_budget > resident ? memory_budget - resident : 0);
+        if (memory_budget > 0 && entries_bytes >= postings_budget) spill_run();
+    }
+
+    std::string docs_data_path() const { return out_dir + FORWARD_INDEX_FILE + ".data.tmp"; }
+
+    void write_forward_index() {
+        docs_data_out.close();
+        if (!docs_data_out) { std::cerr << "Cannot write " << docs_data_path() << "\n"; exit(1); }
+        std::ofstream docs_out(out_dir + FORWARD_INDEX_FILE, std::ios::binary);
+        if (!docs_out) { std::cerr << "Cannot write docs.bin\n"; exit(1); }
 
-        docs_out.seekp(0);
         docs_out.write((char*)&total_docs, 4);
         
         uint64_t data_start_pos = 4 + (uint64_t)total_docs * 8;
@@ -131,93 +678,263 @@ private:
             docs_out.write((char*)&off, 8);
         }
         
-        docs_out.write(docs_data_buffer.data(), docs_data_buffer.size());
+        append_and_remove(docs_out, docs_data_path());
         docs_out.close();
     }
 
-    void tokenize_and_add(const std::string& text, uint32_t doc_id) {
-        std::string current_token;
-        size_t len = text.size();
+    static void tokenize_and_add(WorkerState& state, ChunkResult& result, std::string_view text, uint32_t doc_id) {
+        state.doc_stamp++;
+        state.doc_first_token = result.num_tokens;
+        state.doc_first_entry = result.entries.size();
+        for_each_token(text, [&](std::string_view t) { add_token(state, result, t, doc_id); });
+        if (state.positions) add_doc_positions(state, result);
+    }
 
-        for (size_t i = 0; i < len; ++i) {
-            unsigned char c = text[i];
-            bool is_word = false;
+    // Groups the doc's positions by entry (a counting sort, which keeps
+    // every entry's positions ascending) and appends one record per entry.
+    static void add_doc_positions(WorkerState& state, ChunkResult& result) {
+        size_t num_entries = result.entries.size() - state.doc_first_entry;
+        state.entry_start.assign(num_entries + 1, 0);
+        for (const auto& p : state.doc_positions) state.entry_start[p.first + 1]++;
+        for (size_t e = 0; e < num_entries; ++e) state.entry_start[e + 1] += state.entry_start[e];
 
-            if (is_alphanum(c)) {
-                is_word = true;
-            } else {
-                if (c == '.' && i > 0 && i+1 < len && is_alphanum(text[i-1]) && is_alphanum(text[i+1])) is_word = true;
-                else if ((c == '-' || c == '+') && i > 0 && (is_alphanum(text[i-1]) || text[i-1]=='+')) is_word = true;
-                else if (c == '_' && i > 0 && i+1 < len && is_alphanum(text[i-1]) && is_alphanum(text[i+1])) is_word = true;
-            }
+        state.sorted_positions.resize(state.doc_positions.size());
+        for (const auto& p : state.doc_positions) state.sorted_positions[state.entry_start[p.first]++] = p.second;
 
-            if (is_word) {
-                current_token += c;
-            } else {
-                if (!current_token.empty()) {
-                    to_lower_string(current_token);
-                    entries.push_back({current_token, doc_id});
-                    current_token.clear();
+        uint32_t begin = 0;
+        for (size_t e = 0; e < num_entries; ++e) {
+            result.entry_positions.push_back(result.positions.size());
+            encode_position_record(state.sorted_positions.data() + begin, state.entry_start[e] - begin, result.positions);
+            begin = state.entry_start[e];
+        }
+        state.doc_positions.clear();
+    }
+
+    static void add_token(WorkerState& state, ChunkResult& result, std::string_view token, uint32_t doc_id) {
+        uint32_t id = state.vocab.intern(token);
+        if (id == state.last_doc_seen.size()) {
+            state.last_doc_seen.push_back(0);
+            state.chunk_seen.push_back(UINT64_MAX);
+            state.chunk_local_id.push_back(0);
+            state.doc_entry.push_back(0);
+        }
+
+        if (state.chunk_seen[id] != result.seq) {
+            state.chunk_seen[id] = result.seq;
+            state.chunk_local_id[id] = (uint32_t)result.terms.size();
+            result.terms.push_back(state.vocab.term(id));
+            result.term_counts.push_back(0);
+            result.term_first_token.push_back((uint32_t)result.num_tokens);
+        }
+        uint32_t local_id = state.chunk_local_id[id];
+        uint32_t position = (uint32_t)(result.num_tokens - state.doc_first_token);
+        result.term_counts[local_id]++;
+        result.num_tokens++;
+
+        if (state.last_doc_seen[id] != state.doc_stamp) {
+            state.last_doc_seen[id] = state.doc_stamp;
+            state.doc_entry[id] = (uint32_t)(result.entries.size() - state.doc_first_entry);
+            result.entries.push_back({local_id, doc_id, 0});
+        }
+        result.entries[state.doc_first_entry + state.doc_entry[id]].tf++;
+        if (state.positions) state.doc_positions.push_back({state.doc_entry[id], position});
+    }
+
+    // Counting sort of the entries by term id (a single radix pass over the
+    // whole id range). It is stable, so every term's doc ids stay in corpus
+    // order. Terms are visited in lexical order, which is only computed
+    // here, once per distinct term instead of once per comparison of entries.
+    // With positions, each term's records are gathered into one buffer.
+    template <typename Emit>
+    void emit_sorted_terms(Emit emit) {
+        std::vector<uint32_t> start(vocab.size() + 1, 0);
+        for (const TermEntry& e : entries) start[e.term_id + 1]++;
+        for (uint32_t t = 0; t < vocab.size(); ++t) start[t + 1] += start[t];
+
+        std::vector<uint32_t> doc_ids(entries.size());
+        std::vector<uint32_t> tfs(entries.size());
+        std::vector<uint64_t> record_offsets(entry_positions.size());
+        std::vector<uint32_t> fill(start.begin(), start.end() - 1);
+        for (size_t i = 0; i < entries.size(); ++i) {
+            uint32_t slot = fill[entries[i].term_id]++;
+            doc_ids[slot] = entries[i].doc_id;
+            tfs[slot] = entries[i].tf;
+            if (with_positions) record_offsets[slot] = entry_positions[i];
+        }
+        std::vector<TermEntry>().swap(entries);
+        std::vector<uint64_t>().swap(entry_positions);
+
+        std::vector<uint32_t> order;
+        for (uint32_t t = 0; t < vocab.size(); ++t) {
+            if (start[t + 1] > start[t]) order.push_back(t);
+        }
+        std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+            return vocab.term(a) < vocab.term(b);
+        });
+
+        std::vector<char> records;
+        for (uint32_t t : order) {
+            records.clear();
+            if (with_positions) {
+                for (uint32_t i = start[t]; i < start[t + 1]; ++i) {
+                    const char* rec = positions_data.data() + record_offsets[i];
+                    const char* end = (const char*)skip_position_record((const uint8_t*)rec);
+                    records.insert(records.end(), rec, end);
                 }
             }
+            emit(vocab.term(t), doc_ids.data() + start[t], tfs.data() + start[t], start[t + 1] - start[t], records);
         }
-        if (!current_token.empty()) {
-             to_lower_string(current_token);
-             entries.push_back({current_token, doc_id});
+        std::vector<char>().swap(positions_data);
+    }
+
+    void spill_run() {
+        std::string path = out_dir + RUN_FILE_PREFIX + std::to_string(run_files.size()) + ".tmp";
+        std::ofstream out(path, std::ios::binary);
+        if (!out) { std::cerr << "Cannot write " << path << "\n"; exit(1); }
+
+        emit_sorted_terms([this, &out](std::string_view term, const uint32_t* doc_ids, const uint32_t* tfs,
+                                       uint32_t count, const std::vector<char>& records) {
+            uint16_t t_len = (uint16_t)std::min(term.size(), (size_t)65535);
+            out.write((const char*)&t_len, 2);
+            out.write(term.data(), t_len);
+            out.write((const char*)&count, 4);
+            out.write((const char*)doc_ids, (size_t)count * 4);
+            out.write((const char*)tfs, (size_t)count * 4);
+            if (with_positions) {
+                uint64_t size = records.size();
+                out.write((const char*)&size, 8);
+                out.write(records.data(), size);
+            }
+        });
+        out.close();
+
+        run_files.push_back(path);
+    }
+
+    // Runs cover consecutive doc id ranges, so the postings of a term are
+    // the concatenation of its postings in every run, in run order.
+    void merge_runs() {
+        std::vector<std::unique_ptr<RunReader>> runs;
+        for (const auto& path : run_files) runs.push_back(std::make_unique<RunReader>(path, with_positions));
+
+        auto cmp = [&runs](size_t a, size_t b) {
+            if (runs[a]->term != runs[b]->term) return runs[a]->term > runs[b]->term;
+            return a > b;
+        };
+        std::priority_queue<size_t, std::vector<size_t>, decltype(cmp)> heap(cmp);
+        for (size_t r = 0; r < runs.size(); ++r) if (runs[r]->valid) heap.push(r);
+
+        IndexWriter writer(out_dir + INVERTED_INDEX_FILE, codec, index_flags(), doc_lengths, with_positions);
+        std::vector<uint32_t> doc_ids, tfs;
+        std::vector<char> records;
+        std::string term;
+
+        while (!heap.empty()) {
+            term = runs[heap.top()]->term;
+            doc_ids.clear();
+            tfs.clear();
+            records.clear();
+            while (!heap.empty() && runs[heap.top()]->term == term) {
+                size_t r = heap.top();
+                heap.pop();
+                doc_ids.insert(doc_ids.end(), runs[r]->doc_ids.begin(), runs[r]->doc_ids.end());
+                tfs.insert(tfs.end(), runs[r]->tfs.begin(), runs[r]->tfs.end());
+                records.insert(records.end(), runs[r]->positions.begin(), runs[r]->positions.end());
+                runs[r]->read_next();
+                if (runs[r]->valid) heap.push(r);
+            }
+            writer.add_term(term, doc_ids.data(), tfs.data(), doc_ids.size(), records.data());
         }
+
+        writer.finish();
+        bitmap_terms = writer.bitmap_terms;
+        unique_terms = writer.num_terms();
+        positions_bytes = writer.positions_bytes();
+        frequencies_bytes = writer.frequencies_bytes();
+
+        runs.clear();
+        for (const auto& path : run_files) std::remove(path.c_str());
     }
 
     void write_inverted_index() {
-        std::ofstream idx_out(INVERTED_INDEX_FILE, std::ios::binary);
-        if (!idx_out) { std::cerr << "Error writing index.bin\n"; exit(1); }
+        IndexWriter writer(out_dir + INVERTED_INDEX_FILE, codec, index_flags(), doc_lengths, with_positions);
+        emit_sorted_terms([&writer](std::string_view term, const uint32_t* doc_ids, const uint32_t* tfs,
+                                    uint32_t count, const std::vector<char>& records) {
+            writer.add_term(term, doc_ids, tfs, count, records.data());
+        });
 
-        std::vector<char> dict_buffer;
-        std::vector<char> post_buffer;
-        
-        uint32_t unique_terms_count = 0;
-        
-        if (entries.empty()) return;
+        writer.finish();
+        bitmap_terms = writer.bitmap_terms;
+        unique_terms = writer.num_terms();
+        positions_bytes = writer.positions_bytes();
+        frequencies_bytes = writer.frequencies_bytes();
+    }
 
-        size_t i = 0;
-        size_t n = entries.size();
-        
-        while (i < n) {
-            std::string term = entries[i].term;
-            uint32_t doc_freq = 0;
-            
-            uint64_t rel_offset = post_buffer.size();
-            
-            while (i < n && entries[i].term == term) {
-                 uint32_t did = entries[i].doc_id;
-                 const char* did_ptr = (const char*)&did;
-                 post_buffer.insert(post_buffer.end(), did_ptr, did_ptr + 4);
-                 doc_freq++;
-                 i++;
-            }
-            
-            if (term.size() > 255) term.resize(255);
-            uint8_t t_len = (uint8_t)term.size();
-            
-            dict_buffer.push_back((char)t_len);
-            dict_buffer.insert(dict_buffer.end(), term.begin(), term.end());
-            const char* df_ptr = (const char*)&doc_freq;
-            dict_buffer.insert(dict_buffer.end(), df_ptr, df_ptr + 4);
-            const char* off_ptr = (const char*)&rel_offset;
-            dict_buffer.insert(dict_buffer.end(), off_ptr, off_ptr + 8);
-            
-            unique_terms_count++;
-            total_term_len_sum += term.size();
-        }
-
-        uint64_t dict_size = dict_buffer.size();
-        
-        idx_out.write((char*)&unique_terms_count, 4);
-        idx_out.write((char*)&dict_size, 8);
-        
-        idx_out.write(dict_buffer.data(), dict_buffer.size());
-        idx_out.write(post_buffer.data(), post_buffer.size());
-        
-        idx_out.close();
+    void write_stem_index() {
+        unique_stems = build_stem_index(out_dir, codec, index_flags(), doc_lengths);
+    }
+
+    // Samples the vocabulary growth curve about every 5% of vocabulary size,
+    // which is enough for a log-log Heaps' law fit.
+    void record_vocab_growth(uint64_t tokens_seen) {
+        uint64_t v = vocab.size();
+        if (v < next_heaps_vocab) return;
+        heaps_points.push_back({tokens_seen, v});
+        next_heaps_vocab = std::max(v + 1, v + v / 20);
+    }
+
+    void write_collection_stats() {
+        if (heaps_points.empty() || heaps_points.back().tokens != total_tokens) {
+            heaps_points.push_back({total_tokens, vocab.size()});
+        }
+
+        std::vector<uint32_t> by_freq(vocab.size());
+        for (uint32_t id = 0; id < by_freq.size(); ++id) by_freq[id] = id;
+        std::sort(by_freq.begin(), by_freq.end(), [this](uint32_t a, uint32_t b) {
+            if (coll_freq[a] != coll_freq[b]) return coll_freq[a] > coll_freq[b];
+            return vocab.term(a) < vocab.term(b);
+        });
+
+        std::vector<TermStat> terms;
+        std::string strings;
+        std::vector<uint64_t> postings_hist(STATS_HIST_BUCKETS, 0);
+        terms.reserve(by_freq.size());
+        for (uint32_t id : by_freq) {
+            std::string_view term = vocab.term(id);
+            terms.push_back({coll_freq[id], doc_freq[id], (uint32_t)strings.size(), (uint32_t)term.size(), 0});
+            strings.append(term.data(), term.size());
+            postings_hist[log2_bucket(doc_freq[id])]++;
+        }
+
+        StatsHeader hdr{};
+        hdr.magic = STATS_MAGIC;
+        hdr.version = STATS_VERSION;
+        hdr.num_docs = total_docs;
+        hdr.num_terms = (uint32_t)terms.size();
+        hdr.total_tokens = total_tokens;
+        hdr.strings_size = strings.size();
+        hdr.num_heaps_points = (uint32_t)heaps_points.size();
+        hdr.num_doc_length_buckets = STATS_HIST_BUCKETS;
+        hdr.num_postings_buckets = STATS_HIST_BUCKETS;
+
+        std::ofstream out(out_dir + STATS_FILE, std::ios::binary);
+        if (!out) { std::cerr << "Cannot write " << out_dir + STATS_FILE << "\n"; exit(1); }
+
+        uint64_t pos = align8(sizeof(hdr));
+        write_section(out, (const char*)&hdr, sizeof(hdr), 0);
+        write_section(out, (const char*)terms.data(), terms.size() * sizeof(TermStat), pos);
+        pos = align8(pos + terms.size() * sizeof(TermStat));
+        write_section(out, strings.data(), strings.size(), pos);
+        pos = align8(pos + strings.size());
+        write_section(out, (const char*)heaps_points.data(), heaps_points.size() * sizeof(HeapsPoint), pos);
+        pos = align8(pos + heaps_points.size() * sizeof(HeapsPoint));
+        write_section(out, (const char*)doc_length_hist.data(), STATS_HIST_BUCKETS * 8, pos);
+        pos += STATS_HIST_BUCKETS * 8;
+        write_section(out, (const char*)postings_hist.data(), STATS_HIST_BUCKETS * 8, pos);
+    }
+
+    uint32_t index_flags() const {
+        return fold_yo ? INDEX_FLAG_FOLD_YO : 0;
     }
 
     void print_stats(double seconds) {
@@ -230,11 +947,538 @@ private:
         
         std::cout << "Avg time per doc: " << speed_doc * 1000 << " ms\n";
         std::cout << "Indexing Speed: " << speed_kb << " KB/s\n";
+        std::cout << "Unique terms: " << unique_terms << "\n";
+        std::cout << "Tokens: " << total_tokens << " (stats in " << out_dir + STATS_FILE << ")\n";
+        if (!run_files.empty()) std::cout << "Spilled runs: " << run_files.size() << "\n";
+        if (with_positions) std::cout << "Positions: " << positions_bytes / 1024 << " KB\n";
+        std::cout << "Frequencies: " << frequencies_bytes / 1024 << " KB\n";
+        if (build_stems) std::cout << "Stem dictionary: " << unique_stems << " stems (" << out_dir + STEM_INDEX_FILE << ")\n";
+        std::cout << "Postings codec: " << codec_name(codec) << " (" << bitmap_terms << " dense terms as bitmaps)\n";
+    }
+};
+
+// Assigns doc bases in entry order and writes the manifest.
+void save_manifest(std::vector<ShardInfo>& entries) {
+    uint64_t base = 0;
+    for (ShardInfo& e : entries) {
+        if (base + e.num_docs > UINT32_MAX) { std::cerr << "More than 2^32 docs in the manifest\n"; exit(1); }
+        e.doc_base = (uint32_t)base;
+        base += e.num_docs;
+    }
+    if (!write_manifest(DATA_DIR + MANIFEST_NAME, entries)) {
+        std::cerr << "Cannot write " << DATA_DIR + MANIFEST_NAME << "\n";
+        exit(1);
+    }
+}
+
+// Doc count from the docs.bin header in `dir`; false if there is none.
+bool read_doc_count(const std::string& dir, uint32_t& n) {
+    std::ifstream in(dir + FORWARD_INDEX_FILE, std::ios::binary);
+    return (bool)in.read((char*)&n, 4);
+}
+
+// Shard `s` of `num_shards`: corpus bytes [begin, end) of a corpus of
+// corpus_size bytes. Written once the shard is built.
+struct ShardCut {
+    uint64_t shard, num_shards, begin, end, corpus_size;
+
+    bool operator==(const ShardCut& o) const {
+        return shard == o.shard && num_shards == o.num_shards && begin == o.begin && end == o.end &&
+               corpus_size == o.corpus_size;
+    }
+};
+
+ShardCut shard_cut(unsigned s, unsigned num_shards, uint64_t corpus_size) {
+    return {s, num_shards, corpus_size * s / num_shards, corpus_size * (s + 1) / num_shards, corpus_size};
+}
+
+void write_shard_info(const std::string& dir, const ShardCut& c) {
+    std::ofstream out(dir + SHARD_INFO_FILE);
+    out << c.shard << "\t" << c.num_shards << "\t" << c.begin << "\t" << c.end << "\t" << c.corpus_size << "\n";
+    if (!out) { std::cerr << "Cannot write " << dir + SHARD_INFO_FILE << "\n"; exit(1); }
+}
+
+bool read_shard_info(const std::string& dir, ShardCut& c) {
+    std::ifstream in(dir + SHARD_INFO_FILE);
+    return (bool)(in >> c.shard >> c.num_shards >> c.begin >> c.end >> c.corpus_size);
+}
+
+// Lists shards 0..num_shards-1 in the manifest, with doc bases from their
+// docs.bin headers in shard order. False, naming the shards, while some
+// shard is not built yet or was cut for another --shards N or corpus.
+bool write_shard_manifest(unsigned num_shards, uint64_t corpus_size) {
+    std::vector<ShardInfo> shards;
+    bool complete = true;
+    for (unsigned s = 0; s < num_shards; ++s) {
+        std::string dir = SHARD_DIR_PREFIX + std::to_string(s);
+        ShardCut cut;
+        uint32_t n;
+        if (!read_shard_info(DATA_DIR + dir + "/", cut) || !read_doc_count(DATA_DIR + dir + "/", n)) {
+            std::cout << dir << ": not built\n";
+            complete = false;
+        } else if (!(cut == shard_cut(s, num_shards, corpus_size))) {
+            std::cout << dir << ": cut as shard " << cut.shard << " of " << cut.num_shards << " of a "
+                      << cut.corpus_size << " byte corpus, not shard " << s << " of " << num_shards << "\n";
+            complete = false;
+        } else {
+            shards.push_back({0, n, dir});
+        }
+    }
+    if (!complete) return false;
+    save_manifest(shards);
+    return true;
+}
+
+// Incremental indexing. Newly crawled docs are indexed into a new immutable
+// segment (SEGMENT_DIR_PREFIX<n>/ under DATA_DIR) that is appended to the
+// manifest; an index without a manifest becomes its first entry. Older
+// copies of the new docs' URLs get tombstones. Segments of similar size are
+// merged by compact_segments().
+
+std::string entry_dir(const ShardInfo& e) {
+    return DATA_DIR + e.dir + "/";
+}
+
+bool is_segment(const ShardInfo& e) {
+    return e.dir.compare(0, SEGMENT_DIR_PREFIX.size(), SEGMENT_DIR_PREFIX) == 0;
+}
+
+// Entries of the manifest; without one, the index in DATA_DIR (if any).
+std::vector<ShardInfo> load_manifest() {
+    std::vector<ShardInfo> entries;
+    if (std::ifstream(DATA_DIR + MANIFEST_NAME)) {
+        if (!read_manifest(DATA_DIR + MANIFEST_NAME, entries)) {
+            std::cerr << DATA_DIR + MANIFEST_NAME << " is malformed\n";
+            exit(1);
+        }
+        return entries;
+    }
+    uint32_t n;
+    if (read_doc_count(DATA_DIR, n) && std::ifstream(DATA_DIR + INVERTED_INDEX_FILE)) entries.push_back({0, n, "."});
+    return entries;
+}
+
+// First segment directory name that is neither listed nor on disk.
+std::string new_segment_name(const std::vector<ShardInfo>& entries) {
+    uint64_t n = 0;
+    for (const ShardInfo& e : entries) {
+        if (is_segment(e)) n = std::max<uint64_t>(n, std::stoull("0" + e.dir.substr(SEGMENT_DIR_PREFIX.size())) + 1);
+    }
+    struct stat st;
+    while (stat((DATA_DIR + SEGMENT_DIR_PREFIX + std::to_string(n)).c_str(), &st) == 0) n++;
+    return SEGMENT_DIR_PREFIX + std::to_string(n);
+}
+
+void make_dir(const std::string& dir) {
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) { std::cerr << "Cannot create " << dir << "\n"; exit(1); }
+}
+
+// docs.bin: [u32 n][u64 offset x n][records], a record being
+// [u16 len][url][u16 len][title]. Calls fn(doc, record) in doc order.
+template <typename Fn>
+void for_each_doc_record(const std::string& dir, Fn fn) {
+    MappedFile docs;
+    if (!docs.open(dir + FORWARD_INDEX_FILE)) { std::cerr << "Cannot read " << dir + FORWARD_INDEX_FILE << "\n"; exit(1); }
+    uint32_t n;
+    memcpy(&n, docs.data(), 4);
+    for (uint32_t d = 0; d < n; ++d) {
+        uint64_t begin, end = docs.size();
+        memcpy(&begin, docs.data() + 4 + (uint64_t)d * 8, 8);
+        if (d + 1 < n) memcpy(&end, docs.data() + 4 + (uint64_t)(d + 1) * 8, 8);
+        fn(d, std::string_view(docs.data() + begin, end - begin));
+    }
+}
+
+std::string_view record_url(std::string_view record) {
+    uint16_t len;
+    memcpy(&len, record.data(), 2);
+    return record.substr(2, len);
+}
+
+// Tombstones every doc of `entries` whose URL is in `urls`; returns how
+// many docs were newly deleted.
+uint64_t delete_urls(const std::vector<ShardInfo>& entries, const std::unordered_set<std::string>& urls) {
+    uint64_t deleted = 0;
+    for (const ShardInfo& e : entries) {
+        std::vector<uint64_t> bits = read_tombstones(entry_dir(e), e.num_docs);
+        uint64_t before = deleted;
+        for_each_doc_record(entry_dir(e), [&](uint32_t d, std::string_view record) {
+            if ((bits[d / 64] >> (d % 64)) & 1) return;
+            if (!urls.count(std::string(record_url(record)))) return;
+            bits[d / 64] |= 1ull << (d % 64);
+            deleted++;
+        });
+        if (deleted != before && !write_tombstones(entry_dir(e), bits)) {
+            std::cerr << "Cannot write " << entry_dir(e) + TOMBSTONES_NAME << "\n";
+            exit(1);
+        }
+    }
+    return deleted;
+}
+
+uint32_t live_docs(const ShardInfo& e) {
+    uint32_t deleted = 0;
+    for (uint64_t w : read_tombstones(entry_dir(e), e.num_docs)) deleted += __builtin_popcountll(w);
+    return e.num_docs - deleted;
+}
+
+void remove_segment(const ShardInfo& e) {
+    for (const std::string& name : {FORWARD_INDEX_FILE, INVERTED_INDEX_FILE, STEM_INDEX_FILE, STATS_FILE, TOMBSTONES_NAME}) {
+        std::remove((entry_dir(e) + name).c_str());
     }
+    rmdir(entry_dir(e).c_str());
+}
+
+// One input of merge_segments(), mapped in place.
+struct SegmentReader {
+    MappedFile index;
+    const IndexHeader* hdr = nullptr;
+    const DictEntry* dict = nullptr;
+    const char* strings = nullptr;
+    const uint64_t* term_frequencies = nullptr;
+    const char* frequencies = nullptr;
+    const uint64_t* term_positions = nullptr;
+    const char* positions = nullptr;
+    const uint32_t* doc_lengths = nullptr;
+    bool has_stems = false;
+    std::vector<uint32_t> new_id; // UINT32_MAX for deleted docs
+    uint32_t next_term = 0;
+
+    void open(const std::string& dir) {
+        if (!index.open(dir + INVERTED_INDEX_FILE)) { std::cerr << "Cannot read " << dir + INVERTED_INDEX_FILE << "\n"; exit(1); }
+        hdr = (const IndexHeader*)index.data();
+        if (index.size() < sizeof(IndexHeader) || hdr->magic != INDEX_MAGIC || hdr->version != INDEX_VERSION) {
+            std::cerr << dir + INVERTED_INDEX_FILE << " has an unsupported format\n";
+            exit(1);
+        }
+        if (!index_layout_valid(index.data(), index.size())) {
+            std::cerr << dir + INVERTED_INDEX_FILE << " is truncated or corrupt\n";
+            exit(1);
+        }
+        dict = (const DictEntry*)(index.data() + hdr->dict_offset);
+        strings = index.data() + hdr->strings_offset;
+        term_frequencies = (const uint64_t*)(index.data() + hdr->frequencies_offset);
+        frequencies = (const char*)(term_frequencies + hdr->num_terms);
+        if (hdr->flags & INDEX_FLAG_POSITIONS) {
+            term_positions = (const uint64_t*)(index.data() + hdr->positions_offset);
+            positions = (const char*)(term_positions + hdr->num_terms);
+        }
+        doc_lengths = (const uint32_t*)(index.data() + hdr->doc_lengths_offset);
+        has_stems = (bool)std::ifstream(dir + STEM_INDEX_FILE);
+    }
+
+    bool at_end() const { return next_term >= hdr->num_terms; }
+    std::string_view term() const { return std::string_view(strings + dict[next_term].term_offset, dict[next_term].term_len); }
 };
 
-int main() {
-    Indexer idx;
-    idx.run();
+// Merges `inputs` in order into a new segment in `dir` and returns its doc
+// count. Deleted docs are dropped and the live ones renumbered in order, so
+// every term's merged lists are its lists in the inputs, concatenated with
+// the doc ids remapped; nothing is re-tokenized. Positions are kept if all
+// inputs have them; the stem index is rebuilt if any input had one.
+// index_stats.bin is not written: collection statistics come from full
+// builds.
+uint32_t merge_segments(const std::vector<ShardInfo>& inputs, const std::string& dir) {
+    std::vector<std::unique_ptr<SegmentReader>> segs;
+    bool positions = true, stems = false;
+    for (const ShardInfo& e : inputs) {
+        segs.push_back(std::make_unique<SegmentReader>());
+        segs.back()->open(entry_dir(e));
+        positions = positions && segs.back()->positions != nullptr;
+        stems = stems || segs.back()->has_stems;
+    }
+    uint32_t flags = segs[0]->hdr->flags & INDEX_FLAG_FOLD_YO;
+    uint16_t codec = (uint16_t)segs[0]->hdr->codec;
+    for (const auto& seg : segs) {
+        if ((seg->hdr->flags & INDEX_FLAG_FOLD_YO) != flags) {
+            std::cerr << "Cannot merge segments built with and without --fold-yo\n";
+            exit(1);
+        }
+    }
+
+    std::vector<uint32_t> doc_lengths;
+    std::vector<uint64_t> doc_offsets;
+    std::string docs_data;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        SegmentReader& seg = *segs[i];
+        std::vector<uint64_t> bits = read_tombstones(entry_dir(inputs[i]), inputs[i].num_docs);
+        seg.new_id.assign(inputs[i].num_docs, UINT32_MAX);
+        for_each_doc_record(entry_dir(inputs[i]), [&](uint32_t d, std::string_view record) {
+            if ((bits[d / 64] >> (d % 64)) & 1) return;
+            seg.new_id[d] = (uint32_t)doc_lengths.size();
+            doc_lengths.push_back(seg.doc_lengths[d]);
+            doc_offsets.push_back(docs_data.size());
+            docs_data.append(record.data(), record.size());
+        });
+    }
+
+    uint32_t num_docs = (uint32_t)doc_lengths.size();
+    std::ofstream docs_out(dir + FORWARD_INDEX_FILE, std::ios::binary);
+    if (!docs_out) { std::cerr << "Cannot write " << dir + FORWARD_INDEX_FILE << "\n"; exit(1); }
+    docs_out.write((const char*)&num_docs, 4);
+    for (uint64_t off : doc_offsets) {
+        off += 4 + (uint64_t)num_docs * 8;
+        docs_out.write((const char*)&off, 8);
+    }
+    docs_out.write(docs_data.data(), docs_data.size());
+    docs_out.close();
+
+    IndexWriter writer(dir + INVERTED_INDEX_FILE, codec, flags, doc_lengths, positions);
+    std::vector<uint32_t> doc_ids, tfs, pos;
+    std::vector<char> records;
+    while (true) {
+        std::string_view term;
+        bool found = false;
+        for (const auto& seg : segs) {
+            if (!seg->at_end() && (!found || seg->term() < term)) {
+                term = seg->term();
+                found = true;
+            }
+        }
+        if (!found) break;
+
+        doc_ids.clear();
+        tfs.clear();
+        records.clear();
+        for (const auto& seg : segs) {
+            if (seg->at_end() || seg->term() != term) continue;
+            const DictEntry& e = seg->dict[seg->next_term];
+            PositionCursor pc;
+            if (positions) pc = PositionCursor(seg->positions + seg->term_positions[seg->next_term], e.doc_freq);
+            for (FreqCursor c(seg->frequencies + seg->term_frequencies[seg->next_term], e.doc_freq); !c.at_end(); c.next()) {
+                uint32_t id = seg->new_id[c.doc()];
+                if (id == UINT32_MAX) continue;
+                doc_ids.push_back(id);
+                tfs.push_back(c.tf());
+                if (positions) {
+                    pc.find(c.doc(), pos);
+                    encode_position_record(pos.data(), (uint32_t)pos.size(), records);
+                }
+            }
+        }
+        // `term` points into the inputs, so they advance only after the add.
+        if (!doc_ids.empty()) writer.add_term(term, doc_ids.data(), tfs.data(), doc_ids.size(), records.data());
+        for (const auto& seg : segs) {
+            if (!seg->at_end() && seg->term() == term) seg->next_term++;
+        }
+    }
+    writer.finish();
+
+    if (stems) build_stem_index(dir, codec, flags, doc_lengths);
+    return num_docs;
+}
+
+uint32_t size_tier(uint32_t live) {
+    uint32_t tier = 0;
+    for (; live >= SEGMENT_MERGE_FACTOR; live /= SEGMENT_MERGE_FACTOR) tier++;
+    return tier;
+}
+
+// Tiered compaction. A segment's tier is floor(log_F(live docs)) with
+// F = SEGMENT_MERGE_FACTOR; F adjacent segments of one tier are merged into
+// one of a higher tier, until no tier has F in a row. Each doc is thus
+// rewritten about log_F(total docs) times. Only adjacent segments are merged,
+// which keeps the docs in crawl order. Segments without live docs are
+// dropped; entries that are not segments (an index from a full build,
+// shards) are never touched. The manifest is switched to the merged segment
+// before its inputs are removed, so a searcher never sees a missing file.
+void compact_segments(std::vector<ShardInfo>& entries) {
+    std::vector<ShardInfo> dead;
+    for (size_t i = 0; i < entries.size();) {
+        if (is_segment(entries[i]) && live_docs(entries[i]) == 0) {
+            dead.push_back(entries[i]);
+            entries.erase(entries.begin() + i);
+        } else {
+            i++;
+        }
+    }
+    if (!dead.empty()) {
+        save_manifest(entries);
+        for (const ShardInfo& e : dead) remove_segment(e);
+        std::cout << "Dropped " << dead.size() << " fully deleted segments\n";
+    }
+
+    while (true) {
+        size_t run_start = 0, run_len = 0;
+        uint32_t run_tier = 0;
+        for (size_t i = 0; i < entries.size() && run_len < SEGMENT_MERGE_FACTOR; ++i) {
+            uint32_t tier = is_segment(entries[i]) ? size_tier(live_docs(entries[i])) : UINT32_MAX;
+            if (tier == UINT32_MAX || run_len == 0 || tier != run_tier) {
+                run_start = i;
+                run_len = tier == UINT32_MAX ? 0 : 1;
+                run_tier = tier;
+            } else {
+                run_len++;
+            }
+        }
+        if (run_len < SEGMENT_MERGE_FACTOR) break;
+
+        std::vector<ShardInfo> inputs(entries.begin() + run_start, entries.begin() + run_start + run_len);
+        ShardInfo merged{0, 0, new_segment_name(entries)};
+        make_dir(entry_dir(merged));
+        std::cout << "Merging " << run_len << " tier " << run_tier << " segments into " << merged.dir << "..." << std::endl;
+        merged.num_docs = merge_segments(inputs, entry_dir(merged));
+
+        entries.erase(entries.begin() + run_start, entries.begin() + run_start + run_len);
+        entries.insert(entries.begin() + run_start, merged);
+        save_manifest(entries);
+        for (const ShardInfo& e : inputs) remove_segment(e);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    uint16_t codec = CODEC_BP128;
+    size_t mem_mb = 0;
+    unsigned threads = 1;
+    bool fold_yo = false;
+    bool stems = false;
+    bool positions = false;
+    unsigned num_shards = 0;
+    int only_shard = -1;
+    std::string append_path, delete_path;
+    bool merge = false;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--codec" && i + 1 < argc) {
+            std::string name = argv[++i];
+            if (name == "raw") codec = CODEC_RAW;
+            else if (name == "vbyte") codec = CODEC_VBYTE;
+            else if (name == "bp128") codec = CODEC_BP128;
+            else { std::cerr << "Unknown codec: " << name << "\n"; return 1; }
+        } else if (arg == "--mem-mb" && i + 1 < argc) {
+            mem_mb = std::stoul(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--fold-yo") {
+            fold_yo = true;
+        } else if (arg == "--stem") {
+            stems = true;
+        } else if (arg == "--positions") {
+            positions = true;
+        } else if (arg == "--shards" && i + 1 < argc) {
+            num_shards = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--shard" && i + 1 < argc) {
+            only_shard = std::stoi(argv[++i]);
+        } else if (arg == "--append" && i + 1 < argc) {
+            append_path = argv[++i];
+        } else if (arg == "--delete" && i + 1 < argc) {
+            delete_path = argv[++i];
+        } else if (arg == "--merge") {
+            merge = true;
+        } else {
+            std::cout << "Usage: ./indexer [--codec raw|vbyte|bp128] [--mem-mb N] [--threads N] [--fold-yo] [--stem] [--positions]\n";
+            std::cout << "                 [--shards N [--shard I] | --append FILE | --delete FILE | --merge]\n";
+            std::cout << "  --mem-mb N  keep parsing within about N MB (0 = unlimited): (term id, doc id) entries are\n";
+            std::cout << "              spilled to disk as sorted runs once they reach what the per-doc and per-term\n";
+            std::cout << "              tables leave of N, but at least N/" << MIN_POSTINGS_BUDGET_SHARE << "; urls and titles always go to disk\n";
+            std::cout << "  --fold-yo   index ё as е; the searcher folds queries the same way\n";
+            std::cout << "  --stem      also write " << DATA_DIR + STEM_INDEX_FILE << ", keyed by stems, for ~word queries\n";
+            std::cout << "  --positions store term positions for \"phrase\" and NEAR/k queries\n";
+            std::cout << "  --shards N  cut the corpus into N parts of about equal size, each indexed into\n";
+            std::cout << "              " << DATA_DIR << SHARD_DIR_PREFIX << "<i>/ and listed in " << DATA_DIR + MANIFEST_NAME << "\n";
+            std::cout << "  --shard I   with --shards, build only part I; the manifest is written once\n";
+            std::cout << "              all N parts exist\n";
+            std::cout << "  --append F  index the corpus lines in F (\"-\" = stdin) into a new segment, delete\n";
+            std::cout << "              older docs with the same URLs and merge segments as needed\n";
+            std::cout << "  --delete F  delete the docs whose URLs are listed in F, one per line\n";
+            std::cout << "  --merge     merge segments as needed, e.g. after deletions\n";
+            return 1;
+        }
+    }
+
+    if (!append_path.empty()) {
+        std::vector<ShardInfo> entries = load_manifest();
+        ShardInfo seg{0, 0, new_segment_name(entries)};
+        make_dir(entry_dir(seg));
+        std::cout << "=== Segment " << seg.dir << " <- " << append_path << " ===" << std::endl;
+        Indexer idx(codec, mem_mb * 1024 * 1024, threads, fold_yo, stems, positions);
+        idx.set_input(append_path);
+        idx.set_shard(entry_dir(seg), 0, SIZE_MAX);
+        idx.run();
+        seg.num_docs = idx.num_docs();
+
+        std::unordered_set<std::string> urls;
+        for_each_doc_record(entry_dir(seg), [&urls](uint32_t, std::string_view record) {
+            urls.insert(std::string(record_url(record)));
+        });
+        // The manifest listing the new segment is committed before the
+        // replaced docs are tombstoned, so a reload or a crash in between
+        // serves both copies of a doc, never neither.
+        std::vector<ShardInfo> older = entries;
+        entries.push_back(seg);
+        save_manifest(entries);
+        uint64_t replaced = delete_urls(older, urls);
+        std::cout << "Replaced docs: " << replaced << "\n";
+        compact_segments(entries);
+        std::cout << "Manifest: " << DATA_DIR + MANIFEST_NAME << " (" << entries.size() << " entries)\n";
+        return 0;
+    }
+
+    if (!delete_path.empty() || merge) {
+        std::vector<ShardInfo> entries = load_manifest();
+        if (!delete_path.empty()) {
+            std::ifstream in(delete_path);
+            if (!in) { std::cerr << "Cannot read " << delete_path << "\n"; return 1; }
+            std::unordered_set<std::string> urls;
+            for (std::string line; std::getline(in, line);) {
+                if (!line.empty()) urls.insert(line);
+            }
+            std::cout << "Deleted docs: " << delete_urls(entries, urls) << "\n";
+        }
+        if (merge) {
+            if (!std::ifstream(DATA_DIR + MANIFEST_NAME)) { std::cout << "No segments to merge\n"; return 0; }
+            compact_segments(entries);
+            std::cout << "Manifest: " << DATA_DIR + MANIFEST_NAME << " (" << entries.size() << " entries)\n";
+        }
+        return 0;
+    }
+
+    if (num_shards == 0) {
+        Indexer idx(codec, mem_mb * 1024 * 1024, threads, fold_yo, stems, positions);
+        idx.run();
+        // A full build supersedes the segments of an older index.
+        if (std::ifstream(DATA_DIR + MANIFEST_NAME)) {
+            for (const ShardInfo& e : load_manifest()) {
+                if (is_segment(e)) remove_segment(e);
+            }
+        }
+        std::remove((DATA_DIR + MANIFEST_NAME).c_str());
+        std::remove((DATA_DIR + TOMBSTONES_NAME).c_str());
+        return 0;
+    }
+
+    if (only_shard >= (int)num_shards) { std::cerr << "--shard must be below --shards\n"; return 1; }
+    struct stat st;
+    if (stat(INPUT_FILE.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        std::cerr << "Sharding needs a regular corpus file\n";
+        return 1;
+    }
+
+    // The old manifest no longer matches once a shard is rebuilt; it is
+    // written anew when all shards agree.
+    uint64_t corpus_size = st.st_size;
+    std::remove((DATA_DIR + MANIFEST_NAME).c_str());
+    for (unsigned s = 0; s < num_shards; ++s) {
+        if (only_shard >= 0 && (unsigned)only_shard != s) continue;
+        std::string dir = DATA_DIR + SHARD_DIR_PREFIX + std::to_string(s) + "/";
+        make_dir(dir);
+        std::remove((dir + TOMBSTONES_NAME).c_str());
+        std::remove((dir + SHARD_INFO_FILE).c_str());
+
+        std::cout << "=== Shard " << s << " of " << num_shards << " -> " << dir << " ===" << std::endl;
+        ShardCut cut = shard_cut(s, num_shards, corpus_size);
+        Indexer idx(codec, mem_mb * 1024 * 1024, threads, fold_yo, stems, positions);
+        idx.set_shard(dir, cut.begin, cut.end);
+        idx.run();
+        write_shard_info(dir, cut);
+    }
+
+    if (write_shard_manifest(num_shards, corpus_size)) {
+        std::cout << "Manifest: " << DATA_DIR + MANIFEST_NAME << " (" << num_shards << " shards)\n";
+    } else {
+        std::cout << "Manifest not written yet: build the shards above with --shards " << num_shards
+                  << " --shard I\n";
+    }
     return 0;
 }
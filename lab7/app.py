@@ -1,10 +1,14 @@
 from flask import Flask, request, render_template_string
 import subprocess
+import socket
 import os
 
 app = Flask(__name__)
 
 SEARCHER_BIN = "./searcher" 
+SEARCHER_HOST = os.environ.get("SEARCHER_HOST", "127.0.0.1")
+SEARCHER_PORT = int(os.environ.get("SEARCHER_PORT", 7070))
+SEARCHER_TIMEOUT = 30
 
 HTML_TEMPLATE = """
 <!doctype html>
@@ -33,17 +37,18 @@ HTML_TEMPLATE = """
         <form action="/" method="get">
             <input type="text" name="q" value="{{ query }}" placeholder="Введите запрос (например: java && !script)...">
             <input type="submit" value="Найти">
+            <label><input type="checkbox" name="rank" value="1" {% if rank %}checked{% endif %}> По релевантности</label>
         </form>
     </div>
 
     {% if query %}
-        <div class="meta">Найдено документов: {{ total_count }} (за {{ time_ms }} мс)</div>
+        <div class="meta">Найдено документов: {% if estimated %}≈{% endif %}{{ total_count }} (за {{ time_ms }} мс)</div>
         <hr>
         
         {% for res in results %}
             <div class="result">
                 <div><a href="{{ res.url }}">{{ res.title }}</a></div>
-                <div class="url">{{ res.url }}</div>
+                <div class="url">{{ res.url }}{% if res.score %} · BM25 {{ res.score }}{% endif %}</div>
             </div>
         {% endfor %}
 
@@ -53,12 +58,12 @@ HTML_TEMPLATE = """
 
         <div class="pagination">
             {% if prev_offset >= 0 %}
-                <a href="/?q={{ query }}&offset={{ prev_offset }}">← Назад</a>
+                <a href="/?q={{ query }}&offset={{ prev_offset }}{% if rank %}&rank=1{% endif %}">← Назад</a>
             {% endif %}
             
-            {% if next_offset < total_count %}
+            {% if next_offset < total_count or estimated %}
                 <span style="margin: 0 10px;"></span>
-                <a href="/?q={{ query }}&offset={{ next_offset }}">Вперед →</a>
+                <a href="/?q={{ query }}&offset={{ next_offset }}{% if rank %}&rank=1{% endif %}">Вперед →</a>
             {% endif %}
         </div>
     {% endif %}
@@ -66,43 +71,109 @@ HTML_TEMPLATE = """
 </html>
 """
 
+def daemon_connect():
+    return socket.create_connection((SEARCHER_HOST, SEARCHER_PORT), timeout=SEARCHER_TIMEOUT)
+
+
+def daemon_exchange(sock, line):
+    with sock:
+        sock.sendall((line + "\n").encode('utf-8'))
+        data = b""
+        while not data.endswith(b"\n\n"):
+            chunk = sock.recv(65536)
+            if not chunk:
+                break
+            data += chunk
+    return data.decode('utf-8', errors='replace')
+
+
+def daemon_request(line):
+    return daemon_exchange(daemon_connect(), line)
+
+
+def run_search(query, offset, limit, rank=False):
+    query = query.replace('\t', ' ').replace('\n', ' ').replace('\r', ' ')
+    command = "RANKED" if rank else "SEARCH"
+    # Only a daemon that is not running or is at its client limit ("ERROR\tserver
+    # busy") hands the query to a subprocess; once the daemon has taken it, a
+    # timeout or an ERROR reply is the search's error, not a reason to run
+    # the query again.
+    try:
+        sock = daemon_connect()
+    except OSError:
+        sock = None
+    if sock is not None:
+        try:
+            response = daemon_exchange(sock, f"{command}\t{offset}\t{limit}\t{query}")
+        except socket.timeout:
+            raise RuntimeError(f"Search timed out after {SEARCHER_TIMEOUT} s")
+        except OSError as e:
+            raise RuntimeError(f"Searcher daemon failed: {e}")
+        if not response.startswith("ERROR\tserver busy"):
+            if response.startswith("ERROR\t"):
+                raise RuntimeError("Search error: " + response[len("ERROR\t"):].strip())
+            return response
+
+    cmd = [SEARCHER_BIN, "--ranked" if rank else "--web", query, str(offset), str(limit)]
+    try:
+        process = subprocess.run(cmd, capture_output=True, text=True, encoding='utf-8', timeout=SEARCHER_TIMEOUT)
+    except subprocess.TimeoutExpired:
+        raise RuntimeError(f"Search timed out after {SEARCHER_TIMEOUT} s")
+    if process.returncode != 0:
+        raise RuntimeError(f"Error executing searcher: {process.stderr}")
+    return process.stdout
+
+
+@app.route('/stats')
+def stats():
+    try:
+        return daemon_request("STATS"), 200, {'Content-Type': 'text/plain; charset=utf-8'}
+    except OSError as e:
+        return f"Searcher daemon is not running: {e}", 503
+
+
 @app.route('/')
 def search():
     query = request.args.get('q', '')
     offset = int(request.args.get('offset', 0))
+    rank = request.args.get('rank') == '1'
     limit = 50
     
     results = []
     total_count = 0
+    estimated = False
     time_ms = 0
     
     if query:
         try:
-            cmd = [SEARCHER_BIN, "--web", query, str(offset), str(limit)]
-            process = subprocess.run(cmd, capture_output=True, text=True, encoding='utf-8')
-            
-            if process.returncode != 0:
-                return f"Error executing searcher: {process.stderr}"
-            
-            lines = process.stdout.strip().splitlines()
+            lines = run_search(query, offset, limit, rank).strip().splitlines()
             if len(lines) >= 2:
-                total_count = int(lines[0])
+                # "~N": the searcher estimated the count, and there are
+                # more matches than this page.
+                estimated = lines[0].startswith('~')
+                total_count = int(lines[0].lstrip('~'))
                 time_ms = lines[1]
                 
                 for line in lines[2:]:
                     parts = line.split('\t')
-                    if len(parts) >= 2:
+                    if len(parts) >= 3:
+                        results.append({'url': parts[0], 'title': parts[1], 'score': parts[2]})
+                    elif len(parts) >= 2:
                         results.append({'url': parts[0], 'title': parts[1]})
                     elif len(parts) == 1:
                         results.append({'url': parts[0], 'title': "No Title"})
                         
+        except RuntimeError as e:
+            return str(e)
         except Exception as e:
             return f"System Error: {e}"
 
     return render_template_string(HTML_TEMPLATE, 
                                   query=query, 
+                                  rank=rank,
                                   results=results, 
                                   total_count=total_count,
+                                  estimated=estimated,
                                   time_ms=time_ms,
                                   next_offset = offset + limit,
                                   prev_offset = offset - limit)
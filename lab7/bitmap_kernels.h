@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "../common/cpu_features.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Word-wise kernels for dense doc id bitmaps: dst = dst OP src. On x86 the
+// AVX2 loops are picked at run time (cpu_features.h).
+
+#if defined(HAVE_AVX2_TARGET)
+
+AVX2_TARGET inline size_t bitmap_and_avx2(uint64_t *dst, const uint64_t *src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_and_si256(a, b));
+    }
+    return i;
+}
+
+AVX2_TARGET inline size_t bitmap_or_avx2(uint64_t *dst, const uint64_t *src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(a, b));
+    }
+    return i;
+}
+
+AVX2_TARGET inline size_t bitmap_andnot_avx2(uint64_t *dst, const uint64_t *src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_andnot_si256(b, a));
+    }
+    return i;
+}
+
+#endif
+
+inline void bitmap_and(uint64_t *dst, const uint64_t *src, size_t n)
+{
+    size_t i = 0;
+#if defined(HAVE_AVX2_TARGET)
+    if (cpu_has_avx2())
+        i = bitmap_and_avx2(dst, src, n);
+#elif defined(__ARM_NEON)
+    for (; i + 2 <= n; i += 2)
+        vst1q_u64(dst + i, vandq_u64(vld1q_u64(dst + i), vld1q_u64(src + i)));
+#endif
+    for (; i < n; ++i)
+        dst[i] &= src[i];
+}
+
+inline void bitmap_or(uint64_t *dst, const uint64_t *src, size_t n)
+{
+    size_t i = 0;
+#if defined(HAVE_AVX2_TARGET)
+    if (cpu_has_avx2())
+        i = bitmap_or_avx2(dst, src, n);
+#elif defined(__ARM_NEON)
+    for (; i + 2 <= n; i += 2)
+        vst1q_u64(dst + i, vorrq_u64(vld1q_u64(dst + i), vld1q_u64(src + i)));
+#endif
+    for (; i < n; ++i)
+        dst[i] |= src[i];
+}
+
+inline void bitmap_andnot(uint64_t *dst, const uint64_t *src, size_t n)
+{
+    size_t i = 0;
+#if defined(HAVE_AVX2_TARGET)
+    if (cpu_has_avx2())
+        i = bitmap_andnot_avx2(dst, src, n);
+#elif defined(__ARM_NEON)
+    for (; i + 2 <= n; i += 2)
+        vst1q_u64(dst + i, vbicq_u64(vld1q_u64(dst + i), vld1q_u64(src + i)));
+#endif
+    for (; i < n; ++i)
+        dst[i] &= ~src[i];
+}
+
+inline uint64_t bitmap_popcount(const uint64_t *words, size_t n)
+{
+    uint64_t count = 0;
+    for (size_t i = 0; i < n; ++i)
+        count += __builtin_popcountll(words[i]);
+    return count;
+}
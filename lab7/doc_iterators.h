@@ -0,0 +1,484 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+
+#include "../common/positions_codec.h"
+#include "../common/postings_codec.h"
+#include "bitmap_kernels.h"
+
+// Streaming doc id iterators the query plan is compiled into. Every iterator
+// yields ascending doc ids; advance(target) moves to the first doc >= target
+// and never moves backwards.
+class DocIterator
+{
+public:
+    virtual ~DocIterator() = default;
+
+    virtual bool at_end() const = 0;
+    virtual uint32_t doc() const = 0;
+    virtual void next() = 0;
+    virtual void advance(uint32_t target) = 0;
+
+    // Upper bound on the number of docs the iterator can yield.
+    virtual uint64_t cost() const = 0;
+};
+
+using DocIteratorPtr = std::unique_ptr<DocIterator>;
+
+class EmptyIterator : public DocIterator
+{
+public:
+    bool at_end() const override { return true; }
+    uint32_t doc() const override { return 0; }
+    void next() override {}
+    void advance(uint32_t) override {}
+    uint64_t cost() const override { return 0; }
+};
+
+class TermIterator : public DocIterator
+{
+private:
+    PostingCursor cursor;
+
+public:
+    explicit TermIterator(const PostingCursor &c) : cursor(c) {}
+
+    bool at_end() const override { return cursor.at_end(); }
+    uint32_t doc() const override { return cursor.doc(); }
+    void next() override { cursor.next(); }
+    void advance(uint32_t target) override { cursor.advance(target); }
+    uint64_t cost() const override { return cursor.size(); }
+};
+
+// Dense doc id set: either a term's bitmap straight from the mmapped index
+// or a bitmap owned by the iterator (result of a bitmap kernel). It may
+// cover only a window of words of the whole bitmap, starting at word
+// `first`; docs outside the window are not yielded.
+class BitmapIterator : public DocIterator
+{
+private:
+    std::vector<uint64_t> owned;
+    const uint64_t *words; // word `first_word` of the bitmap
+    size_t first_word;
+    size_t num_words;
+    uint64_t count;
+    uint32_t cur = 0;
+    bool exhausted = false;
+
+public:
+    BitmapIterator(const uint64_t *w, size_t n, uint64_t popcount, size_t first = 0)
+        : words(w), first_word(first), num_words(n), count(popcount)
+    {
+        seek(0);
+    }
+
+    explicit BitmapIterator(std::vector<uint64_t> bits, size_t first = 0) : owned(std::move(bits)), first_word(first)
+    {
+        words = owned.data();
+        num_words = owned.size();
+        count = bitmap_popcount(words, num_words);
+        seek(0);
+    }
+
+    const uint64_t *data() const { return words; }
+    size_t size_words() const { return num_words; }
+    size_t first() const { return first_word; }
+
+    bool at_end() const override { return exhausted; }
+    uint32_t doc() const override { return cur; }
+    void next() override { seek((uint64_t)cur + 1); }
+
+    void advance(uint32_t target) override
+    {
+        if (!exhausted && target > cur)
+            seek(target);
+    }
+
+    uint64_t cost() const override { return count; }
+
+private:
+    void seek(uint64_t from)
+    {
+        from = std::max<uint64_t>(from, (uint64_t)first_word * 64);
+        size_t w = (from >> 6) - first_word;
+        if (w >= num_words)
+        {
+            exhausted = true;
+            return;
+        }
+        uint64_t word = words[w] & (~0ull << (from & 63));
+        while (!word)
+        {
+            if (++w >= num_words)
+            {
+                exhausted = true;
+                return;
+            }
+            word = words[w];
+        }
+        cur = (uint32_t)((first_word + w) * 64 + __builtin_ctzll(word));
+    }
+};
+
+// Already decoded doc ids, shared with a cache. advance() gallops from the
+// current position, so short hops stay cheap on long lists.
+class ListIterator : public DocIterator
+{
+private:
+    std::shared_ptr<const std::vector<uint32_t>> list;
+    size_t pos = 0;
+
+public:
+    explicit ListIterator(std::shared_ptr<const std::vector<uint32_t>> docs) : list(std::move(docs)) {}
+
+    bool at_end() const override { return pos >= list->size(); }
+    uint32_t doc() const override { return (*list)[pos]; }
+    void next() override { pos++; }
+
+    void advance(uint32_t target) override
+    {
+        const std::vector<uint32_t> &v = *list;
+        if (pos >= v.size() || v[pos] >= target)
+            return;
+        size_t step = 1;
+        while (pos + step < v.size() && v[pos + step] < target)
+            step *= 2;
+        auto first = v.begin() + pos + step / 2 + 1;
+        auto last = v.begin() + std::min(pos + step + 1, v.size());
+        pos = std::lower_bound(first, last, target) - v.begin();
+    }
+
+    uint64_t cost() const override { return list->size(); }
+};
+
+// n-ary intersection. Children are ordered by ascending cost, the cheapest
+// one leads and the others are only advanced to its candidates.
+class AndIterator : public DocIterator
+{
+private:
+    std::vector<DocIteratorPtr> children;
+    bool exhausted = false;
+    uint32_t cur = 0;
+
+public:
+    explicit AndIterator(std::vector<DocIteratorPtr> kids) : children(std::move(kids))
+    {
+        std::sort(children.begin(), children.end(),
+                  [](const DocIteratorPtr &a, const DocIteratorPtr &b)
+                  { return a->cost() < b->cost(); });
+        find_match();
+    }
+
+    bool at_end() const override { return exhausted; }
+    uint32_t doc() const override { return cur; }
+
+    void next() override
+    {
+        children[0]->next();
+        find_match();
+    }
+
+    void advance(uint32_t target) override
+    {
+        if (exhausted || cur >= target)
+            return;
+        children[0]->advance(target);
+        find_match();
+    }
+
+    uint64_t cost() const override { return children[0]->cost(); }
+
+private:
+    void find_match()
+    {
+        DocIterator &lead = *children[0];
+        while (!lead.at_end())
+        {
+            uint32_t candidate = lead.doc();
+            size_t i = 1;
+            for (; i < children.size(); ++i)
+            {
+                children[i]->advance(candidate);
+                if (children[i]->at_end())
+                {
+                    exhausted = true;
+                    return;
+                }
+                if (children[i]->doc() != candidate)
+                    break;
+            }
+            if (i == children.size())
+            {
+                cur = candidate;
+                return;
+            }
+            lead.advance(children[i]->doc());
+        }
+        exhausted = true;
+    }
+};
+
+// n-ary union over a min-heap of children keyed by their current doc.
+class OrIterator : public DocIterator
+{
+private:
+    std::vector<DocIteratorPtr> children;
+    std::vector<DocIterator *> heap;
+    uint64_t total_cost = 0;
+
+    static bool heap_cmp(const DocIterator *a, const DocIterator *b)
+    {
+        return a->doc() > b->doc();
+    }
+
+public:
+    explicit OrIterator(std::vector<DocIteratorPtr> kids) : children(std::move(kids))
+    {
+        for (auto &c : children)
+        {
+            total_cost += c->cost();
+            if (!c->at_end())
+                heap.push_back(c.get());
+        }
+        std::make_heap(heap.begin(), heap.end(), heap_cmp);
+    }
+
+    bool at_end() const override { return heap.empty(); }
+    uint32_t doc() const override { return heap.front()->doc(); }
+
+    void next() override
+    {
+        uint32_t cur = heap.front()->doc();
+        while (!heap.empty() && heap.front()->doc() == cur)
+            step_top([](DocIterator *it) { it->next(); });
+    }
+
+    void advance(uint32_t target) override
+    {
+        while (!heap.empty() && heap.front()->doc() < target)
+            step_top([target](DocIterator *it) { it->advance(target); });
+    }
+
+    uint64_t cost() const override { return total_cost; }
+
+private:
+    template <typename Step>
+    void step_top(Step step)
+    {
+        std::pop_heap(heap.begin(), heap.end(), heap_cmp);
+        DocIterator *it = heap.back();
+        step(it);
+        if (it->at_end())
+            heap.pop_back();
+        else
+            std::push_heap(heap.begin(), heap.end(), heap_cmp);
+    }
+};
+
+// Docs of include that are not in exclude: a difference merge that only
+// advances exclude to the candidates include produces.
+class AndNotIterator : public DocIterator
+{
+private:
+    DocIteratorPtr include;
+    DocIteratorPtr exclude;
+
+public:
+    AndNotIterator(DocIteratorPtr inc, DocIteratorPtr exc) : include(std::move(inc)), exclude(std::move(exc))
+    {
+        settle();
+    }
+
+    bool at_end() const override { return include->at_end(); }
+    uint32_t doc() const override { return include->doc(); }
+
+    void next() override
+    {
+        include->next();
+        settle();
+    }
+
+    void advance(uint32_t target) override
+    {
+        include->advance(target);
+        settle();
+    }
+
+    uint64_t cost() const override { return include->cost(); }
+
+private:
+    void settle()
+    {
+        while (!include->at_end())
+        {
+            exclude->advance(include->doc());
+            if (exclude->at_end() || exclude->doc() != include->doc())
+                return;
+            include->next();
+        }
+    }
+};
+
+// Complement of the child within [0, total_docs). Only used for a query
+// that is a pure negation at the top level.
+class NotIterator : public DocIterator
+{
+private:
+    DocIteratorPtr child;
+    uint32_t total_docs;
+    uint32_t cur = 0;
+
+public:
+    NotIterator(DocIteratorPtr c, uint32_t total) : child(std::move(c)), total_docs(total)
+    {
+        settle();
+    }
+
+    bool at_end() const override { return cur >= total_docs; }
+    uint32_t doc() const override { return cur; }
+
+    void next() override
+    {
+        cur++;
+        settle();
+    }
+
+    void advance(uint32_t target) override
+    {
+        if (target <= cur)
+            return;
+        cur = target;
+        settle();
+    }
+
+    uint64_t cost() const override { return total_docs; }
+
+private:
+    void settle()
+    {
+        while (cur < total_docs)
+        {
+            child->advance(cur);
+            if (child->at_end() || child->doc() != cur)
+                return;
+            cur++;
+        }
+    }
+};
+
+// Where a phrase (a single term is a phrase of length 1) starts in a doc:
+// word i of the phrase has to occur at start + i. Words are checked one at
+// a time and the first one that leaves no candidate start ends the check,
+// so later words' positions are not decoded at all.
+class PhraseMatcher
+{
+private:
+    std::vector<PositionCursor> words;
+    std::vector<uint32_t> buf;
+
+public:
+    void add_word(const PositionCursor &c) { words.push_back(c); }
+    uint32_t length() const { return (uint32_t)words.size(); }
+
+    bool match(uint32_t doc, std::vector<uint32_t> &starts)
+    {
+        if (!words[0].find(doc, starts))
+            return false;
+        for (uint32_t i = 1; i < words.size() && !starts.empty(); ++i)
+        {
+            if (!words[i].find(doc, buf))
+                return false;
+            size_t kept = 0, j = 0;
+            for (uint32_t s : starts)
+            {
+                while (j < buf.size() && buf[j] < s + i)
+                    j++;
+                if (j < buf.size() && buf[j] == s + i)
+                    starts[kept++] = s;
+            }
+            starts.resize(kept);
+        }
+        return !starts.empty();
+    }
+};
+
+// Docs of the doc-level intersection of all the words that also pass the
+// positional check: one phrase, or two phrases at most max_distance tokens
+// apart in either order (NEAR/k). Positions are only decoded for the docs
+// the inner iterator yields.
+class PositionalIterator : public DocIterator
+{
+private:
+    DocIteratorPtr inner;
+    std::vector<PhraseMatcher> phrases;
+    uint32_t max_distance;
+    std::vector<uint32_t> starts_a, starts_b;
+
+public:
+    PositionalIterator(DocIteratorPtr it, std::vector<PhraseMatcher> p, uint32_t distance = 0)
+        : inner(std::move(it)), phrases(std::move(p)), max_distance(distance)
+    {
+        settle();
+    }
+
+    bool at_end() const override { return inner->at_end(); }
+    uint32_t doc() const override { return inner->doc(); }
+
+    void next() override
+    {
+        inner->next();
+        settle();
+    }
+
+    void advance(uint32_t target) override
+    {
+        if (inner->at_end() || inner->doc() >= target)
+            return;
+        inner->advance(target);
+        settle();
+    }
+
+    uint64_t cost() const override { return inner->cost(); }
+
+private:
+    void settle()
+    {
+        while (!inner->at_end() && !accept(inner->doc()))
+            inner->next();
+    }
+
+    bool accept(uint32_t doc)
+    {
+        if (!phrases[0].match(doc, starts_a))
+            return false;
+        if (phrases.size() == 1)
+            return true;
+        if (!phrases[1].match(doc, starts_b))
+            return false;
+
+        // Gap between the end of the earlier span and the start of the
+        // later one; for a given a, later b only get further away.
+        uint32_t len_a = phrases[0].length(), len_b = phrases[1].length();
+        size_t i = 0, j = 0;
+        while (i < starts_a.size() && j < starts_b.size())
+        {
+            uint32_t a = starts_a[i], b = starts_b[j];
+            if (a <= b)
+            {
+                if (b <= a + len_a - 1 + max_distance)
+                    return true;
+                i++;
+            }
+            else
+            {
+                if (a <= b + len_b - 1 + max_distance)
+                    return true;
+                j++;
+            }
+        }
+        return false;
+    }
+};
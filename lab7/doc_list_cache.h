@@ -0,0 +1,147 @@
+#pragma once
+
+#include <vector>
+#include <list>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <cstdint>
+
+// LRU cache of doc id lists under a byte budget, shared by all threads of a
+// searcher. Lists are handed out as shared pointers, so an evicted list
+// stays valid for the queries still reading it.
+class DocListCache
+{
+public:
+    using List = std::shared_ptr<const std::vector<uint32_t>>;
+
+private:
+    // A list may take at most this part of the budget, so one huge result
+    // cannot flush everything else.
+    static const size_t MAX_ENTRY_SHARE = 4;
+    // Keys remembered after a miss, for admit_on_repeat().
+    static const size_t GHOST_KEYS = 4096;
+
+    struct Entry
+    {
+        std::string key;
+        List list;
+    };
+
+    size_t budget;
+    size_t used = 0;
+    std::list<Entry> lru; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> entries;
+    // Ghost keys by generation; an entry of ghost_order whose generation is
+    // no longer the key's is stale and expires without effect.
+    std::deque<std::pair<std::string, uint64_t>> ghost_order;
+    std::unordered_map<std::string, uint64_t> ghosts;
+    uint64_t next_generation = 0;
+    mutable std::mutex mtx;
+
+    uint64_t num_hits = 0;
+    uint64_t num_misses = 0;
+    uint64_t num_evictions = 0;
+
+    static size_t charge(const Entry &e)
+    {
+        return e.list->size() * sizeof(uint32_t) + e.key.size() + 64;
+    }
+
+public:
+    explicit DocListCache(size_t budget_bytes) : budget(budget_bytes) {}
+
+    // nullptr on a miss.
+    List get(const std::string &key)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = entries.find(key);
+        if (it == entries.end())
+        {
+            num_misses++;
+            return nullptr;
+        }
+        num_hits++;
+        lru.splice(lru.begin(), lru, it->second);
+        return it->second->list;
+    }
+
+    void put(const std::string &key, List list)
+    {
+        Entry e{key, std::move(list)};
+        size_t size = charge(e);
+        if (size > budget / MAX_ENTRY_SHARE)
+            return;
+
+        std::lock_guard<std::mutex> lock(mtx);
+        if (entries.count(key))
+            return;
+        while (used + size > budget && !lru.empty())
+        {
+            used -= charge(lru.back());
+            entries.erase(lru.back().key);
+            lru.pop_back();
+            num_evictions++;
+        }
+        lru.push_front(std::move(e));
+        entries[key] = lru.begin();
+        used += size;
+    }
+
+    // True if `key` missed recently before; otherwise remembers it. Lets a
+    // caller cache only what is asked for more than once.
+    bool admit_on_repeat(const std::string &key)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (ghosts.erase(key))
+            return true;
+        if (ghost_order.size() >= GHOST_KEYS)
+        {
+            auto oldest = ghosts.find(ghost_order.front().first);
+            if (oldest != ghosts.end() && oldest->second == ghost_order.front().second)
+                ghosts.erase(oldest);
+            ghost_order.pop_front();
+        }
+        ghost_order.push_back({key, next_generation});
+        ghosts[key] = next_generation++;
+        return false;
+    }
+
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t entries = 0;
+        uint64_t bytes = 0;
+
+        Stats &operator+=(const Stats &o)
+        {
+            hits += o.hits;
+            misses += o.misses;
+            evictions += o.evictions;
+            entries += o.entries;
+            bytes += o.bytes;
+            return *this;
+        }
+
+        // key<TAB>value lines, keys prefixed by `name`.
+        void report(std::ostream &out, const std::string &name) const
+        {
+            out << name << "_hits\t" << hits << "\n";
+            out << name << "_misses\t" << misses << "\n";
+            out << name << "_evictions\t" << evictions << "\n";
+            out << name << "_entries\t" << entries << "\n";
+            out << name << "_bytes\t" << bytes << "\n";
+        }
+    };
+
+    Stats stats() const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return {num_hits, num_misses, num_evictions, entries.size(), used};
+    }
+};
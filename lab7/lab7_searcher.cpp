@@ -1,35 +1,63 @@
 #include <iostream>
-#include <fstream>
 #include <vector>
 #include <string>
 #include <algorithm>
 #include <stack>
 #include <sstream>
 #include <cstring>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <csignal>
+#include <cerrno>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string_view>
+#include <stdexcept>
+#include <unordered_map>
+#include <atomic>
+#include <cstdlib>
+#include <sys/time.h>
 
-const std::string DOCS_FILE = "../data/docs.bin";
-const std::string INDEX_FILE = "../data/index.bin";
+#include "../common/case_fold.h"
+#include "../common/index_format.h"
+#include "../common/mapped_file.h"
+#include "../common/postings_codec.h"
+#include "../common/shard_manifest.h"
+#include "../common/stemmer.h"
+#include "../common/tokenizer.h"
+#include "doc_iterators.h"
+#include "doc_list_cache.h"
+#include "thread_pool.h"
+#include "wand.h"
 
-struct DocInfo
-{
-    uint64_t offset;
-};
-
-struct TermInfo
-{
-    std::string term;
-    uint32_t doc_freq;
-    uint64_t postings_offset;
-
-    bool operator<(const TermInfo &other) const
-    {
-        return term < other.term;
-    }
-    bool operator<(const std::string &val) const
-    {
-        return term < val;
-    }
-};
+const std::string DATA_DIR = "../data/";
+// Index files, in DATA_DIR or in every shard's directory.
+const std::string DOCS_FILE = "docs.bin";
+const std::string INDEX_FILE = "index.bin";
+const std::string STEM_INDEX_FILE = "index_stem.bin";
+const int DEFAULT_SERVE_PORT = 7070;
+// Connections the daemon serves at once (one thread each); more are
+// refused. A connection idle for CLIENT_IDLE_SECONDS is closed.
+const int MAX_CLIENTS = 64;
+const int CLIENT_IDLE_SECONDS = 60;
+const size_t LATENCY_WINDOW = 10000;
+// Plans whose iterator cost is below this run on the calling thread alone.
+const uint64_t PARALLEL_MIN_COST = 1 << 16;
+// Doc id ranges per pool thread, so that uneven ranges balance out.
+const size_t RANGES_PER_THREAD = 4;
+// Cache budgets of every index (shard or segment) the searcher opens.
+const size_t RESULT_CACHE_BYTES = 64 << 20;
+const size_t POSTINGS_CACHE_BYTES = 64 << 20;
+// Shorter postings lists fit in one block and are not worth caching.
+const uint32_t POSTINGS_CACHE_MIN_DOCS = 128;
+// A result page of a plan with a cost below this is cut from the full,
+// cached result; a costlier plan is streamed up to the page.
+const uint64_t RESULT_STREAM_MIN_COST = 1 << 16;
+// Matches counted past a streamed page before the total is estimated.
+const uint64_t ESTIMATE_SAMPLE_DOCS = 10000;
 
 bool is_alphanum(unsigned char c)
 {
@@ -40,193 +68,322 @@ bool is_alphanum(unsigned char c)
     return false;
 }
 
-void to_lower_string(std::string &str)
+// Offset or limit of a request. Negatives and garbage give 0; large values
+// saturate, so offset + limit cannot overflow.
+uint64_t parse_count(const std::string &s)
+{
+    long long v = std::strtoll(s.c_str(), nullptr, 10);
+    return v <= 0 ? 0 : std::min<uint64_t>((uint64_t)v, UINT32_MAX);
+}
+
+// "NEAR/k" operator token; sets k.
+bool parse_near(const std::string &token, uint32_t &k)
+{
+    if (token.size() <= 5 || token.compare(0, 5, "NEAR/") != 0)
+        return false;
+    if (!std::all_of(token.begin() + 5, token.end(), [](char c) { return c >= '0' && c <= '9'; }))
+        return false;
+    k = (uint32_t)std::min(std::stoul(token.substr(5, 9)), 1000000000ul);
+    return true;
+}
+
+// Query plan: the RPN produced by the parser is folded into a tree where
+// chains of the same associative operator become one n-ary node.
+struct QueryNode
 {
-    for (size_t i = 0; i < str.size(); ++i)
+    enum Type
     {
-        unsigned char c = static_cast<unsigned char>(str[i]);
-        if (c >= 'A' && c <= 'Z')
-            str[i] = c + 32;
-        if (c == 0xD0 && i + 1 < str.size())
-        {
-            unsigned char next = static_cast<unsigned char>(str[i + 1]);
-            if (next >= 0x90 && next <= 0xAF)
-            {
-                if (next <= 0x9F)
-                    str[i + 1] = next + 0x20;
-                else
-                {
-                    str[i] = 0xD1;
-                    str[i + 1] = next - 0x20;
-                }
-            }
-        }
+        TERM,
+        AND,
+        OR,
+        NOT,
+        PHRASE, // children are the TERM words, in order
+        NEAR    // two children within `distance` positions
+    };
+
+    Type type;
+    std::string term;
+    bool stemmed = false; // ~term: look the stem up in index_stem.bin
+    uint32_t distance = 0;
+    std::vector<std::unique_ptr<QueryNode>> children;
+    DocListCache::List postings; // TERM: decoded postings, set by resolve_postings()
+};
+
+using QueryNodePtr = std::unique_ptr<QueryNode>;
+
+// A compiled plan node is kept symbolic: when negated is set the node
+// stands for the complement of what the iterator yields.
+struct CompiledSet
+{
+    DocIteratorPtr it;
+    bool negated = false;
+
+    bool is_empty() const
+    {
+        return !negated && it->cost() == 0;
     }
-}
+    bool is_universe() const
+    {
+        return negated && it->cost() == 0;
+    }
+};
 
-class SearchEngine
+// Doc ids [begin, end) a plan is compiled for. Bitmaps are cut to the words
+// that cover the range, so the kernels of a range only touch its words.
+// The compiled iterator can still yield docs outside the range; callers
+// advance it to begin first and stop at end.
+struct DocRange
 {
-private:
-    std::vector<TermInfo> dictionary;
-    std::ifstream idx_in;
-    std::ifstream docs_in;
+    uint32_t begin = 0;
+    uint64_t end = UINT64_MAX;
 
-    uint32_t total_docs = 0;
-    std::vector<uint64_t> doc_offsets;
+    size_t first_word() const { return begin >> 6; }
 
-    uint64_t postings_start_pos = 0;
+    // Words [first_word(), end_word) of a bitmap of `num_words` words.
+    size_t end_word(size_t num_words) const
+    {
+        return std::max(first_word(), (size_t)std::min<uint64_t>(num_words, end / 64 + (end % 64 != 0)));
+    }
+};
 
-public:
-    SearchEngine()
+// One mmapped index file in the index.bin layout (index_format.h): the
+// surface dictionary, or the stem dictionary written by `indexer --stem`.
+struct IndexFile
+{
+    MappedFile map;
+    const IndexHeader *header = nullptr;
+    const DictEntry *dictionary = nullptr;
+    const char *strings = nullptr;
+    const char *postings = nullptr;
+    const uint64_t *term_positions = nullptr; // per DictEntry, when the index has positions
+    const char *positions = nullptr;
+    const uint64_t *term_frequencies = nullptr; // per DictEntry
+    const char *frequencies = nullptr;
+    const uint32_t *doc_lengths = nullptr;
+    double avg_doc_length = 1;
+
+    bool open(const std::string &path)
     {
-        idx_in.open(INDEX_FILE, std::ios::binary);
-        docs_in.open(DOCS_FILE, std::ios::binary);
+        if (!map.open(path))
+            return false;
 
-        if (!idx_in || !docs_in)
+        header = (const IndexHeader *)map.data();
+        if (map.size() < sizeof(IndexHeader) || header->magic != INDEX_MAGIC || header->version != INDEX_VERSION)
         {
-            std::cerr << "CRITICAL ERROR: Could not open index files. Run Lab 6 first.\n";
-            exit(1);
+            throw std::runtime_error(path + " has an unsupported format. Rebuild it with Lab 6.");
+        }
+        if (!index_layout_valid(map.data(), map.size()))
+        {
+            throw std::runtime_error(path + " is truncated or corrupt. Rebuild it with Lab 6.");
         }
 
-        load_docs_index();
-        load_dictionary();
+        dictionary = (const DictEntry *)(map.data() + header->dict_offset);
+        strings = map.data() + header->strings_offset;
+        postings = map.data() + header->postings_offset;
+        if (header->flags & INDEX_FLAG_POSITIONS)
+        {
+            term_positions = (const uint64_t *)(map.data() + header->positions_offset);
+            positions = (const char *)(term_positions + header->num_terms);
+        }
+        term_frequencies = (const uint64_t *)(map.data() + header->frequencies_offset);
+        frequencies = (const char *)(term_frequencies + header->num_terms);
+        doc_lengths = (const uint32_t *)(map.data() + header->doc_lengths_offset);
+        if (header->num_docs > 0 && header->total_tokens > 0)
+            avg_doc_length = (double)header->total_tokens / header->num_docs;
+        return true;
     }
 
-    void load_docs_index()
+    bool is_open() const
     {
-        docs_in.seekg(0);
-        docs_in.read((char *)&total_docs, 4);
-        doc_offsets.resize(total_docs);
-        docs_in.read((char *)doc_offsets.data(), total_docs * 8);
+        return map.is_open();
     }
 
-    void load_dictionary()
+    bool has_positions() const
     {
-        uint32_t num_terms;
-        uint64_t dict_size;
+        return positions != nullptr;
+    }
 
-        idx_in.seekg(0);
-        idx_in.read((char *)&num_terms, 4);
-        idx_in.read((char *)&dict_size, 8);
+    std::string_view term_at(const DictEntry &e) const
+    {
+        return std::string_view(strings + e.term_offset, e.term_len);
+    }
 
-        postings_start_pos = 12 + dict_size;
+    const DictEntry *find_term(std::string_view term) const
+    {
+        const DictEntry *end = dictionary + header->num_terms;
+        auto it = std::lower_bound(dictionary, end, term,
+                                   [this](const DictEntry &e, std::string_view val)
+                                   { return term_at(e) < val; });
 
-        std::vector<char> dict_buffer(dict_size);
-        idx_in.read(dict_buffer.data(), dict_size);
+        if (it != end && term_at(*it) == term)
+            return it;
+        return nullptr;
+    }
 
-        dictionary.reserve(num_terms);
+    // Normalizes a query term the way the indexer normalized this file's
+    // terms, then looks it up.
+    const DictEntry *lookup(const std::string &raw_term) const
+    {
+        std::string term = raw_term;
+        to_lower_string(term, header->flags & INDEX_FLAG_FOLD_YO);
+        if (header->flags & INDEX_FLAG_STEMMED)
+            return find_term(stem(term));
+        return find_term(term);
+    }
 
-        size_t ptr = 0;
-        while (ptr < dict_size)
-        {
-            uint8_t t_len = (uint8_t)dict_buffer[ptr];
-            ptr++;
-            std::string t_str(dict_buffer.data() + ptr, t_len);
-            ptr += t_len;
+    PostingCursor open_cursor(const DictEntry &e) const
+    {
+        return PostingCursor(postings + e.postings_offset, e.doc_freq, e.codec);
+    }
 
-            uint32_t d_freq;
-            memcpy(&d_freq, dict_buffer.data() + ptr, 4);
-            ptr += 4;
+    PositionCursor open_positions(const DictEntry &e) const
+    {
+        return PositionCursor(positions + term_positions[&e - dictionary], e.doc_freq);
+    }
 
-            uint64_t p_off;
-            memcpy(&p_off, dict_buffer.data() + ptr, 8);
-            ptr += 8;
+    // Scores with the given idf and average doc length, which may be of a
+    // larger collection than this file's.
+    TermScorer open_scorer(const DictEntry &e, double idf, double avgdl) const
+    {
+        FreqCursor cursor(frequencies + term_frequencies[&e - dictionary], e.doc_freq);
+        return TermScorer(cursor, idf, doc_lengths, avgdl, avg_doc_length);
+    }
+};
 
-            dictionary.push_back({t_str, d_freq, p_off});
-        }
+// BM25 statistics of the whole collection for the terms of one query,
+// summed over all shards and segments, so a doc scores the same however
+// the index is split. Deleted docs still count until their segment is
+// merged.
+struct RankingStats
+{
+    uint64_t num_docs = 0;
+    uint64_t total_tokens = 0;
+    std::unordered_map<std::string, uint64_t> doc_freq; // by SearchEngine::term_key()
+
+    RankingStats &operator+=(const RankingStats &o)
+    {
+        num_docs += o.num_docs;
+        total_tokens += o.total_tokens;
+        for (const auto &[term, df] : o.doc_freq)
+            doc_freq[term] += df;
+        return *this;
     }
 
-    std::vector<uint32_t> get_postings(const std::string &raw_term)
+    double idf(const std::string &term) const
     {
-        std::string term = raw_term;
-        to_lower_string(term);
+        auto it = doc_freq.find(term);
+        return bm25_idf(it == doc_freq.end() ? 0 : it->second, num_docs);
+    }
 
-        auto it = std::lower_bound(dictionary.begin(), dictionary.end(), term);
+    double avg_doc_length() const
+    {
+        return num_docs > 0 && total_tokens > 0 ? (double)total_tokens / num_docs : 1;
+    }
+};
 
-        if (it != dictionary.end() && it->term == term)
-        {
-            std::vector<uint32_t> result(it->doc_freq);
+class SearchEngine
+{
+private:
+    IndexFile index;
+    IndexFile stem_index;
+    MappedFile docs_map;
 
-            uint64_t abs_offset = postings_start_pos + it->postings_offset;
-            idx_in.seekg(abs_offset);
-            idx_in.read((char *)result.data(), it->doc_freq * 4);
+    uint32_t total_docs = 0;
+    const char *doc_offsets = nullptr;
 
-            return result;
-        }
-        return {};
-    }
+    // Tombstones (deleted.bin); empty when nothing is deleted.
+    std::vector<uint64_t> deleted;
+    uint64_t deleted_count = 0;
 
-    std::vector<uint32_t> op_and(const std::vector<uint32_t> &a, const std::vector<uint32_t> &b)
+    // All matches of a plan, by plan_key(), and decoded postings of terms
+    // that are asked for repeatedly.
+    DocListCache result_cache{RESULT_CACHE_BYTES};
+    DocListCache postings_cache{POSTINGS_CACHE_BYTES};
+
+    ThreadPool &pool;
+
+public:
+    // One index: the one in DATA_DIR or one shard's.
+    SearchEngine(const std::string &dir, ThreadPool &p) : pool(p)
     {
-        std::vector<uint32_t> res;
-        size_t i = 0, j = 0;
-        while (i < a.size() && j < b.size())
+        if (!index.open(dir + INDEX_FILE) || !docs_map.open(dir + DOCS_FILE))
         {
-            if (a[i] < b[j])
-                i++;
-            else if (b[j] < a[i])
-                j++;
-            else
-            {
-                res.push_back(a[i]);
-                i++;
-                j++;
-            }
+            throw std::runtime_error("Could not open index files in " + dir + ". Run Lab 6 first.");
         }
-        return res;
+        stem_index.open(dir + STEM_INDEX_FILE);
+
+        load_docs_index();
+
+        deleted = read_tombstones(dir, total_docs);
+        deleted_count = bitmap_popcount(deleted.data(), deleted.size());
+        if (deleted_count == 0)
+            deleted.clear();
     }
 
-    std::vector<uint32_t> op_or(const std::vector<uint32_t> &a, const std::vector<uint32_t> &b)
+    void load_docs_index()
     {
-        std::vector<uint32_t> res;
-        size_t i = 0, j = 0;
-        while (i < a.size() && j < b.size())
+        if (docs_map.size() < 4)
+            throw std::runtime_error("docs.bin is truncated. Run Lab 6 first.");
+        memcpy(&total_docs, docs_map.data(), 4);
+        doc_offsets = docs_map.data() + 4;
+
+        if (docs_map.size() < 4 + (uint64_t)total_docs * 8)
         {
-            if (a[i] < b[j])
-            {
-                res.push_back(a[i]);
-                i++;
-            }
-            else if (b[j] < a[i])
-            {
-                res.push_back(b[j]);
-                j++;
-            }
-            else
-            {
-                res.push_back(a[i]);
-                i++;
-                j++;
-            }
+            throw std::runtime_error("docs.bin is truncated. Run Lab 6 first.");
         }
-        while (i < a.size())
-            res.push_back(a[i++]);
-        while (j < b.size())
-            res.push_back(b[j++]);
-        return res;
     }
 
-    std::vector<uint32_t> op_not(const std::vector<uint32_t> &a)
+    uint32_t num_docs() const
     {
-        std::vector<uint32_t> res;
-        size_t i = 0;
-        for (uint32_t doc_id = 0; doc_id < total_docs; ++doc_id)
-        {
-            if (i < a.size() && a[i] == doc_id)
-            {
-                i++;
-            }
-            else
-            {
-                res.push_back(doc_id);
-            }
-        }
-        return res;
+        return total_docs;
+    }
+
+    uint64_t num_deleted() const
+    {
+        return deleted_count;
+    }
+
+    DocListCache::Stats result_cache_stats() const
+    {
+        return result_cache.stats();
+    }
+
+    DocListCache::Stats postings_cache_stats() const
+    {
+        return postings_cache.stats();
+    }
+
+    // ~term looks up the stem dictionary; without one (indexer run without
+    // --stem) it degrades to an exact match.
+    const IndexFile &index_for(const QueryNode &node) const
+    {
+        if (node.stemmed && stem_index.is_open())
+            return stem_index;
+        return index;
+    }
+
+    std::vector<uint32_t> get_postings(const std::string &raw_term)
+    {
+        const DictEntry *e = index.lookup(raw_term);
+        if (!e)
+            return {};
+        std::vector<uint32_t> result(e->doc_freq);
+        decode_postings(index.postings + e->postings_offset, e->doc_freq, e->codec, result.data());
+        return result;
+    }
+
+    static bool is_operator(const std::string &t)
+    {
+        uint32_t k;
+        return t == "&&" || t == "||" || t == "!" || parse_near(t, k);
     }
 
     int precedence(const std::string &op)
     {
+        uint32_t k;
         if (op == "!")
+            return 4;
+        if (parse_near(op, k))
             return 3;
         if (op == "&&")
             return 2;
@@ -235,7 +392,7 @@ public:
         return 0;
     }
 
-    std::vector<uint32_t> execute_query(std::string query)
+    std::vector<std::string> to_rpn(const std::string &query)
     {
         std::vector<std::string> tokens;
         std::string current;
@@ -243,7 +400,21 @@ public:
         for (size_t i = 0; i < query.size(); ++i)
         {
             char c = query[i];
-            if (c == ' ' || c == '(' || c == ')' || c == '!' || c == '&' || c == '|')
+            if (c == '"')
+            {
+                // A quoted phrase is one token, kept with its opening quote.
+                if (!current.empty())
+                {
+                    tokens.push_back(current);
+                    current.clear();
+                }
+                size_t close = query.find('"', i + 1);
+                if (close == std::string::npos)
+                    close = query.size();
+                tokens.push_back(query.substr(i, close - i));
+                i = close;
+            }
+            else if (c == ' ' || c == '(' || c == ')' || c == '!' || c == '&' || c == '|')
             {
                 if (!current.empty())
                 {
@@ -283,11 +454,8 @@ public:
             {
                 std::string t1 = tokens[i];
                 std::string t2 = tokens[i + 1];
-                bool t1_is_op = (t1 == "&&" || t1 == "||" || t1 == "!" || t1 == "(");
-                bool t2_is_op = (t2 == "&&" || t2 == "||" || t2 == ")" || t2 == "!");
-
-                bool t1_is_val = (t1 != "&&" && t1 != "||" && t1 != "!" && t1 != "(");
-                bool t2_is_val = (t2 != "&&" && t2 != "||" && t2 != ")");
+                bool t1_is_val = !is_operator(t1) && t1 != "(";
+                bool t2_is_val = (t2 == "!" || !is_operator(t2)) && t2 != ")";
 
                 if (t1_is_val && t2_is_val)
                 {
@@ -301,7 +469,7 @@ public:
 
         for (const auto &t : fixed_tokens)
         {
-            if (t == "&&" || t == "||" || t == "!")
+            if (is_operator(t))
             {
                 while (!ops.empty() && ops.top() != "(" && precedence(ops.top()) >= precedence(t))
                 {
@@ -334,48 +502,668 @@ public:
             rpn.push_back(ops.top());
             ops.pop();
         }
+        return rpn;
+    }
 
-        std::stack<std::vector<uint32_t>> eval_stack;
+    static QueryNodePtr make_term_node(const std::string &t)
+    {
+        auto node = std::make_unique<QueryNode>();
+        node->type = QueryNode::TERM;
+        node->stemmed = t.size() > 1 && t[0] == '~';
+        node->term = node->stemmed ? t.substr(1) : t;
+        return node;
+    }
+
+    // The phrase is tokenized like document text, so its words line up with
+    // the indexed positions; a one-word phrase is just that term.
+    QueryNodePtr make_phrase_node(std::string text)
+    {
+        to_lower_string(text, index.header->flags & INDEX_FLAG_FOLD_YO);
+        auto node = std::make_unique<QueryNode>();
+        node->type = QueryNode::PHRASE;
+        for_each_token(text, [&node](std::string_view w)
+                       { node->children.push_back(make_term_node(std::string(w))); });
+
+        if (node->children.size() == 1)
+            return std::move(node->children[0]);
+        if (node->children.empty())
+            return make_term_node("");
+        return node;
+    }
+
+    QueryNodePtr build_plan(const std::vector<std::string> &rpn)
+    {
+        std::stack<QueryNodePtr> eval_stack;
 
         for (const auto &t : rpn)
         {
-            if (t == "&&")
+            uint32_t near_k;
+            if (parse_near(t, near_k))
             {
                 if (eval_stack.size() < 2)
                     continue;
-                auto b = eval_stack.top();
+                auto node = std::make_unique<QueryNode>();
+                node->type = QueryNode::NEAR;
+                node->distance = near_k;
+                node->children.resize(2);
+                node->children[1] = std::move(eval_stack.top());
                 eval_stack.pop();
-                auto a = eval_stack.top();
+                node->children[0] = std::move(eval_stack.top());
                 eval_stack.pop();
-                eval_stack.push(op_and(a, b));
+                eval_stack.push(std::move(node));
             }
-            else if (t == "||")
+            else if (t == "&&" || t == "||")
             {
                 if (eval_stack.size() < 2)
                     continue;
-                auto b = eval_stack.top();
+                QueryNodePtr b = std::move(eval_stack.top());
                 eval_stack.pop();
-                auto a = eval_stack.top();
+                QueryNodePtr a = std::move(eval_stack.top());
                 eval_stack.pop();
-                eval_stack.push(op_or(a, b));
+
+                auto node = std::make_unique<QueryNode>();
+                node->type = (t == "&&") ? QueryNode::AND : QueryNode::OR;
+                for (QueryNodePtr *child : {&a, &b})
+                {
+                    if ((*child)->type == node->type)
+                    {
+                        for (auto &grandchild : (*child)->children)
+                            node->children.push_back(std::move(grandchild));
+                    }
+                    else
+                    {
+                        node->children.push_back(std::move(*child));
+                    }
+                }
+                eval_stack.push(std::move(node));
             }
             else if (t == "!")
             {
                 if (eval_stack.empty())
                     continue;
-                auto a = eval_stack.top();
+                auto node = std::make_unique<QueryNode>();
+                node->type = QueryNode::NOT;
+                node->children.push_back(std::move(eval_stack.top()));
                 eval_stack.pop();
-                eval_stack.push(op_not(a));
+                eval_stack.push(std::move(node));
+            }
+            else if (t[0] == '"')
+            {
+                eval_stack.push(make_phrase_node(t.substr(1)));
             }
             else
             {
-                eval_stack.push(get_postings(t));
+                eval_stack.push(make_term_node(t));
             }
         }
 
         if (eval_stack.empty())
+            return nullptr;
+        return std::move(eval_stack.top());
+    }
+
+    // Replaces all bitmap children with a single bitmap combined by the
+    // SIMD kernel, so dense terms never go through the iterator merge.
+    template <typename Kernel>
+    static void fold_bitmaps(std::vector<DocIteratorPtr> &kids, Kernel kernel)
+    {
+        std::vector<const BitmapIterator *> bitmaps;
+        for (const auto &k : kids)
+            if (auto *b = dynamic_cast<const BitmapIterator *>(k.get()))
+                bitmaps.push_back(b);
+        if (bitmaps.size() < 2)
+            return;
+
+        size_t first = bitmaps[0]->first();
+        std::vector<uint64_t> combined(bitmaps[0]->data(), bitmaps[0]->data() + bitmaps[0]->size_words());
+        for (size_t i = 1; i < bitmaps.size(); ++i)
+            kernel(combined.data(), bitmaps[i]->data(), combined.size());
+
+        kids.erase(std::remove_if(kids.begin(), kids.end(), [](const DocIteratorPtr &k)
+                                  { return dynamic_cast<const BitmapIterator *>(k.get()) != nullptr; }),
+                   kids.end());
+        kids.push_back(std::make_unique<BitmapIterator>(std::move(combined), first));
+    }
+
+    static DocIteratorPtr make_and(std::vector<DocIteratorPtr> kids)
+    {
+        fold_bitmaps(kids, bitmap_and);
+        if (kids.empty())
+            return std::make_unique<EmptyIterator>();
+        if (kids.size() == 1)
+            return std::move(kids[0]);
+        return std::make_unique<AndIterator>(std::move(kids));
+    }
+
+    static DocIteratorPtr make_or(std::vector<DocIteratorPtr> kids)
+    {
+        fold_bitmaps(kids, bitmap_or);
+        if (kids.empty())
+            return std::make_unique<EmptyIterator>();
+        if (kids.size() == 1)
+            return std::move(kids[0]);
+        return std::make_unique<OrIterator>(std::move(kids));
+    }
+
+    static DocIteratorPtr make_and_not(DocIteratorPtr include, DocIteratorPtr exclude)
+    {
+        if (include->cost() == 0 || exclude->cost() == 0)
+            return include;
+
+        auto *inc_bits = dynamic_cast<const BitmapIterator *>(include.get());
+        auto *exc_bits = dynamic_cast<const BitmapIterator *>(exclude.get());
+        if (inc_bits && exc_bits)
+        {
+            std::vector<uint64_t> diff(inc_bits->data(), inc_bits->data() + inc_bits->size_words());
+            bitmap_andnot(diff.data(), exc_bits->data(), diff.size());
+            return std::make_unique<BitmapIterator>(std::move(diff), inc_bits->first());
+        }
+        return std::make_unique<AndNotIterator>(std::move(include), std::move(exclude));
+    }
+
+    // Decoded postings of a term from the cache. A term is decoded and
+    // cached on its second miss among the recent ones; nullptr until then.
+    DocListCache::List cached_postings(const IndexFile &source, const DictEntry &e)
+    {
+        if (e.codec == CODEC_BITMAP || e.doc_freq < POSTINGS_CACHE_MIN_DOCS)
+            return nullptr;
+        std::string key = (&source == &stem_index ? "~" : "") + std::to_string(&e - source.dictionary);
+        if (auto list = postings_cache.get(key))
+            return list;
+        if (!postings_cache.admit_on_repeat(key))
+            return nullptr;
+        auto list = std::make_shared<std::vector<uint32_t>>(e.doc_freq);
+        decode_postings(source.postings + e.postings_offset, e.doc_freq, e.codec, list->data());
+        postings_cache.put(key, list);
+        return list;
+    }
+
+    // Asks the postings cache for every term of the plan once per query,
+    // however often the plan is compiled afterwards (once per doc id range,
+    // or again as a ranking filter).
+    void resolve_postings(QueryNode &node, std::unordered_map<std::string, DocListCache::List> &seen)
+    {
+        for (auto &child : node.children)
+            resolve_postings(*child, seen);
+        if (node.type != QueryNode::TERM)
+            return;
+
+        std::string key = (node.stemmed ? "~" : "") + node.term;
+        auto it = seen.find(key);
+        if (it == seen.end())
+        {
+            const IndexFile &source = index_for(node);
+            const DictEntry *e = source.lookup(node.term);
+            it = seen.emplace(key, e ? cached_postings(source, *e) : nullptr).first;
+        }
+        node.postings = it->second;
+    }
+
+    // The words of a bitmap that cover `range`; `count` is the bitmap's
+    // popcount, kept as the iterator's cost.
+    static DocIteratorPtr bitmap_window(const uint64_t *bits, size_t num_words, uint64_t count, DocRange range)
+    {
+        size_t first = std::min(range.first_word(), num_words);
+        return std::make_unique<BitmapIterator>(bits + first, range.end_word(num_words) - first, count, first);
+    }
+
+    // Leaves start at the range's first doc (through the skip table), so a
+    // plan compiled for a doc id range never decodes postings before the
+    // range. `cached` is the term's list from resolve_postings(), if any.
+    static DocIteratorPtr make_term(const IndexFile &source, const DictEntry &e, DocRange range,
+                                    const DocListCache::List &cached)
+    {
+        DocIteratorPtr it;
+        if (e.codec == CODEC_BITMAP)
+            it = bitmap_window((const uint64_t *)(source.postings + e.postings_offset), e.postings_bytes / 8,
+                               e.doc_freq, range);
+        else if (cached)
+            it = std::make_unique<ListIterator>(cached);
+        else
+            it = std::make_unique<TermIterator>(source.open_cursor(e));
+        if (range.begin > 0)
+            it->advance(range.begin);
+        return it;
+    }
+
+    // Negations are pushed up the tree instead of being enumerated:
+    //   a && !b       -> a AND-NOT b
+    //   !a && !b      -> !(a || b)
+    //   a || !b       -> !(b AND-NOT a)
+    //   !a || !b      -> !(a && b)
+    CompiledSet compile(const QueryNode &node, DocRange range)
+    {
+        switch (node.type)
+        {
+        case QueryNode::TERM:
+        {
+            const IndexFile &source = index_for(node);
+            const DictEntry *e = source.lookup(node.term);
+            if (!e)
+                return {std::make_unique<EmptyIterator>(), false};
+            return {make_term(source, *e, range, node.postings), false};
+        }
+        case QueryNode::NOT:
+        {
+            CompiledSet child = compile(*node.children[0], range);
+            child.negated = !child.negated;
+            return child;
+        }
+        case QueryNode::AND:
+            return compile_and(node.children, range);
+        case QueryNode::PHRASE:
+        case QueryNode::NEAR:
+            return compile_positional(node, range);
+        case QueryNode::OR:
+        {
+            std::vector<DocIteratorPtr> pos, neg;
+            for (const auto &child : node.children)
+            {
+                CompiledSet c = compile(*child, range);
+                if (c.is_universe())
+                    return {std::make_unique<EmptyIterator>(), true};
+                if (c.is_empty())
+                    continue;
+                (c.negated ? neg : pos).push_back(std::move(c.it));
+            }
+            if (neg.empty())
+                return {make_or(std::move(pos)), false};
+            return {make_and_not(make_and(std::move(neg)), make_or(std::move(pos))), true};
+        }
+        }
+        return {std::make_unique<EmptyIterator>(), false};
+    }
+
+    CompiledSet compile_and(const std::vector<QueryNodePtr> &children, DocRange range)
+    {
+        std::vector<DocIteratorPtr> pos, neg;
+        for (const auto &child : children)
+        {
+            CompiledSet c = compile(*child, range);
+            if (c.is_empty())
+                return {std::make_unique<EmptyIterator>(), false};
+            if (c.is_universe())
+                continue;
+            (c.negated ? neg : pos).push_back(std::move(c.it));
+        }
+        if (pos.empty() && neg.empty())
+            return {std::make_unique<EmptyIterator>(), true};
+        if (pos.empty())
+            return {make_or(std::move(neg)), true};
+        return {make_and_not(make_and(std::move(pos)), make_or(std::move(neg))), false};
+    }
+
+    static bool is_positional(const QueryNode &node)
+    {
+        return (node.type == QueryNode::TERM && !node.stemmed) || node.type == QueryNode::PHRASE;
+    }
+
+    // Adds the postings of every word of a TERM or PHRASE node to `kids`
+    // and its position cursors to `phrase`; false if a word is not indexed.
+    bool add_phrase(const QueryNode &node, std::vector<DocIteratorPtr> &kids, PhraseMatcher &phrase, DocRange range)
+    {
+        std::vector<const QueryNode *> words;
+        if (node.type == QueryNode::PHRASE)
+            for (const auto &child : node.children)
+                words.push_back(child.get());
+        else
+            words.push_back(&node);
+
+        for (const QueryNode *word : words)
+        {
+            const DictEntry *e = index.lookup(word->term);
+            if (!e)
+                return false;
+            kids.push_back(make_term(index, *e, range, word->postings));
+            phrase.add_word(index.open_positions(*e));
+        }
+        return true;
+    }
+
+    // Phrases and NEAR run as the AND of all their words, filtered by
+    // positions. Without a positions section in the index, or for a NEAR
+    // over something that is not a term or phrase, only the AND is left.
+    CompiledSet compile_positional(const QueryNode &node, DocRange range)
+    {
+        bool positional = index.has_positions();
+        for (const auto &child : node.children)
+            positional = positional && (node.type == QueryNode::PHRASE || is_positional(*child));
+        if (!positional)
+            return compile_and(node.children, range);
+
+        std::vector<DocIteratorPtr> kids;
+        std::vector<PhraseMatcher> phrases(node.type == QueryNode::NEAR ? 2 : 1);
+        bool found = node.type == QueryNode::NEAR ? add_phrase(*node.children[0], kids, phrases[0], range) &&
+                                                        add_phrase(*node.children[1], kids, phrases[1], range)
+                                                  : add_phrase(node, kids, phrases[0], range);
+        if (!found)
+            return {std::make_unique<EmptyIterator>(), false};
+        return {std::make_unique<PositionalIterator>(make_and(std::move(kids)), std::move(phrases), node.distance),
+                false};
+    }
+
+    // A negated bitmap is complemented within the range's words only.
+    DocIteratorPtr compile_top(const QueryNode &node, DocRange range = {})
+    {
+        CompiledSet set = compile(node, range);
+        if (!set.negated)
+            return std::move(set.it);
+
+        if (auto *bits = dynamic_cast<const BitmapIterator *>(set.it.get()))
+        {
+            size_t num_words = bitmap_words(total_docs);
+            size_t first = std::min(range.first_word(), num_words);
+            std::vector<uint64_t> all(range.end_word(num_words) - first, ~0ull);
+            if (total_docs % 64 && !all.empty() && first + all.size() == num_words)
+                all.back() = (1ull << (total_docs % 64)) - 1;
+            bitmap_andnot(all.data(), bits->data(), std::min(all.size(), bits->size_words()));
+            return std::make_unique<BitmapIterator>(std::move(all), first);
+        }
+        return std::make_unique<NotIterator>(std::move(set.it), total_docs);
+    }
+
+    // The plan's matches minus the deleted docs.
+    DocIteratorPtr compile_live(const QueryNode &node, DocRange range = {})
+    {
+        DocIteratorPtr it = compile_top(node, range);
+        if (deleted_count == 0)
+            return it;
+        return make_and_not(std::move(it), bitmap_window(deleted.data(), deleted.size(), deleted_count, range));
+    }
+
+    // Upper bound on the plan's matches from the dictionary's doc freqs
+    // alone, for choosing how to evaluate a plan before compiling it.
+    uint64_t plan_cost(const QueryNode &node) const
+    {
+        switch (node.type)
+        {
+        case QueryNode::TERM:
+        {
+            const DictEntry *e = index_for(node).lookup(node.term);
+            return e ? e->doc_freq : 0;
+        }
+        case QueryNode::NOT:
+            return total_docs;
+        case QueryNode::OR:
+        {
+            uint64_t sum = 0;
+            for (const auto &child : node.children)
+                sum += plan_cost(*child);
+            return std::min<uint64_t>(sum, total_docs);
+        }
+        default: // AND, PHRASE, NEAR: the cheapest positive child
+        {
+            uint64_t least = total_docs;
+            for (const auto &child : node.children)
+                if (child->type != QueryNode::NOT)
+                    least = std::min(least, plan_cost(*child));
+            return least;
+        }
+        }
+    }
+
+    // All matches of the plan in doc id order. A plan with long enough
+    // postings is split into doc id ranges that are evaluated on the pool,
+    // each compiled on its own over the range's bitmap words only, and the
+    // ranges' matches are concatenated.
+    std::vector<uint32_t> evaluate(const QueryNode &plan)
+    {
+        std::vector<uint32_t> results;
+        if (pool.concurrency() == 1 || plan_cost(plan) < PARALLEL_MIN_COST)
+        {
+            for (DocIteratorPtr it = compile_live(plan); !it->at_end(); it->next())
+                results.push_back(it->doc());
+            return results;
+        }
+
+        // Whole bitmap words per range, so no word is combined twice.
+        size_t ranges = pool.concurrency() * RANGES_PER_THREAD;
+        uint64_t width = ((uint64_t)total_docs + ranges - 1) / ranges;
+        width = (width + 63) & ~(uint64_t)63;
+        std::vector<std::vector<uint32_t>> parts(ranges);
+        auto run_range = [&](size_t r)
+        {
+            uint64_t begin = r * width, end = std::min<uint64_t>(begin + width, total_docs);
+            if (begin >= end)
+                return;
+            DocIteratorPtr range_it = compile_live(plan, {(uint32_t)begin, end});
+            for (range_it->advance((uint32_t)begin); !range_it->at_end() && range_it->doc() < end; range_it->next())
+                parts[r].push_back(range_it->doc());
+        };
+        pool.parallel_for(ranges, run_range);
+
+        size_t total = 0;
+        for (const auto &part : parts)
+            total += part.size();
+        results.reserve(total);
+        for (const auto &part : parts)
+            results.insert(results.end(), part.begin(), part.end());
+        return results;
+    }
+
+    // Canonical text of a plan. Operands of AND and OR are sorted, so
+    // "a && b" and "b && a" share a result cache entry; terms carry their
+    // length, so no term can be mistaken for operator syntax.
+    static std::string plan_key(const QueryNode &node)
+    {
+        if (node.type == QueryNode::TERM)
+            return (node.stemmed ? "~" : "") + std::to_string(node.term.size()) + ":" + node.term;
+
+        std::vector<std::string> keys;
+        for (const auto &child : node.children)
+            keys.push_back(plan_key(*child));
+        if (node.type == QueryNode::AND || node.type == QueryNode::OR)
+            std::sort(keys.begin(), keys.end());
+
+        static const char *const names[] = {"", "AND", "OR", "NOT", "PHRASE", "NEAR"};
+        std::string key = names[node.type];
+        if (node.type == QueryNode::NEAR)
+            key += "/" + std::to_string(node.distance);
+        key += "(";
+        for (size_t i = 0; i < keys.size(); ++i)
+            key += (i ? "," : "") + keys[i];
+        return key + ")";
+    }
+
+    // evaluate() through the result cache.
+    DocListCache::List matches(QueryNode &plan)
+    {
+        std::string key = plan_key(plan);
+        if (auto cached = result_cache.get(key))
+            return cached;
+        std::unordered_map<std::string, DocListCache::List> seen;
+        resolve_postings(plan, seen);
+        auto list = std::make_shared<const std::vector<uint32_t>>(evaluate(plan));
+        result_cache.put(key, list);
+        return list;
+    }
+
+    struct ResultPage
+    {
+        std::vector<uint32_t> docs; // the first matches, in doc id order
+        uint64_t total = 0;
+        bool estimated = false; // total is extrapolated, and more than docs.size()
+        DocListCache::List all; // every match, when they were materialized or cached
+    };
+
+    // Iterators whose cost() is their exact number of docs.
+    static bool cost_is_count(const DocIterator &it)
+    {
+        return dynamic_cast<const BitmapIterator *>(&it) || dynamic_cast<const TermIterator *>(&it) ||
+               dynamic_cast<const ListIterator *>(&it);
+    }
+
+    // The first `n` matches of the plan and the number of all matches. A
+    // result that is not cached and may be large (by plan_cost(), so the
+    // plan is not compiled just to decide) is never materialized: the plan
+    // is streamed up to the n-th match. Its count is then exact if the plan
+    // compiled to a single bitmap or postings list, or if the matches end
+    // within ESTIMATE_SAMPLE_DOCS past the page; otherwise it is
+    // extrapolated from how much of the doc id space those matches cover.
+    ResultPage first_matches(QueryNode &plan, size_t n)
+    {
+        ResultPage page;
+        DocListCache::List all;
+        if (plan_cost(plan) < RESULT_STREAM_MIN_COST)
+            all = matches(plan);
+        else
+            all = result_cache.get(plan_key(plan));
+        if (all)
+        {
+            page.docs.assign(all->begin(), all->begin() + std::min(n, all->size()));
+            page.total = all->size();
+            page.all = all;
+            return page;
+        }
+
+        std::unordered_map<std::string, DocListCache::List> seen;
+        resolve_postings(plan, seen);
+        DocIteratorPtr it = compile_live(plan);
+
+        for (; !it->at_end() && page.docs.size() < n; it->next())
+            page.docs.push_back(it->doc());
+        if (cost_is_count(*it))
+        {
+            page.total = it->cost();
+            return page;
+        }
+
+        uint64_t counted = page.docs.size();
+        for (; !it->at_end() && counted < n + ESTIMATE_SAMPLE_DOCS; it->next())
+            counted++;
+        page.total = counted;
+        if (!it->at_end())
+        {
+            // The counted matches are all below the next one.
+            uint64_t share = (uint64_t)((double)counted * total_docs / it->doc());
+            page.total = std::max(counted + 1, std::min(share, it->cost()));
+            page.estimated = true;
+        }
+        return page;
+    }
+
+    ResultPage execute_page(const std::string &query, size_t n)
+    {
+        QueryNodePtr plan = build_plan(to_rpn(query));
+        if (!plan)
             return {};
-        return eval_stack.top();
+        return first_matches(*plan, n);
+    }
+
+    // All matches in doc id order, shared with the result cache, so paging
+    // through a query evaluates it once.
+    DocListCache::List execute_query(const std::string &query)
+    {
+        QueryNodePtr plan = build_plan(to_rpn(query));
+        if (!plan)
+            return std::make_shared<const std::vector<uint32_t>>();
+        return matches(*plan);
+    }
+
+    // Words the ranking is computed from: every term under the plan that is
+    // not negated, phrase and NEAR words included, each counted once.
+    void collect_scoring_terms(const QueryNode &node, std::vector<std::pair<const IndexFile *, const DictEntry *>> &out)
+    {
+        switch (node.type)
+        {
+        case QueryNode::TERM:
+        {
+            const IndexFile &source = index_for(node);
+            const DictEntry *e = source.lookup(node.term);
+            if (e && std::find(out.begin(), out.end(), std::make_pair(&source, e)) == out.end())
+                out.push_back({&source, e});
+            return;
+        }
+        case QueryNode::NOT:
+            return;
+        default:
+            for (const auto &child : node.children)
+                collect_scoring_terms(*child, out);
+        }
+    }
+
+    // A bare term or a disjunction of terms matches exactly the docs that
+    // have a scoring term, so it needs no boolean filter.
+    static bool is_pure_disjunction(const QueryNode &node)
+    {
+        if (node.type == QueryNode::TERM)
+            return true;
+        if (node.type != QueryNode::OR)
+            return false;
+        return std::all_of(node.children.begin(), node.children.end(), [](const QueryNodePtr &c)
+                           { return c->type == QueryNode::TERM; });
+    }
+
+    // Scoring terms of different shards are matched by their dictionary
+    // text; stems are kept apart from words.
+    std::string term_key(const IndexFile &source, const DictEntry &e) const
+    {
+        return (&source == &stem_index ? "~" : "") + std::string(source.term_at(e));
+    }
+
+    // Adds this index's doc count, token count and the doc freqs of the
+    // query's scoring terms to `stats`.
+    void add_ranking_stats(const std::string &query, RankingStats &stats)
+    {
+        stats.num_docs += index.header->num_docs;
+        stats.total_tokens += index.header->total_tokens;
+        QueryNodePtr plan = build_plan(to_rpn(query));
+        if (!plan)
+            return;
+        std::vector<std::pair<const IndexFile *, const DictEntry *>> terms;
+        collect_scoring_terms(*plan, terms);
+        for (const auto &[source, e] : terms)
+            stats.doc_freq[term_key(*source, *e)] += e->doc_freq;
+    }
+
+    // The k best matches by BM25 under the collection `stats`, best first.
+    // The boolean query decides what matches and its positive terms decide
+    // the order; Block-Max WAND scores only the docs that can still make the
+    // top k. Matches without any scoring term get score 0 and come last, in
+    // doc id order. The total is counted as by first_matches(), so it may be
+    // estimated; a match list it had at hand is reused as the filter.
+    std::vector<ScoredDoc> execute_ranked(const std::string &query, size_t k, const RankingStats &stats,
+                                          uint64_t &total, bool &estimated)
+    {
+        total = 0;
+        estimated = false;
+        QueryNodePtr plan = build_plan(to_rpn(query));
+        if (!plan)
+            return {};
+
+        ResultPage counted = first_matches(*plan, 0);
+        total = counted.total;
+        estimated = counted.estimated;
+        k = std::min<size_t>(k, total_docs);
+        auto compile_matches = [&]() -> DocIteratorPtr
+        {
+            if (counted.all)
+                return std::make_unique<ListIterator>(counted.all);
+            return compile_live(*plan);
+        };
+
+        std::vector<std::pair<const IndexFile *, const DictEntry *>> terms;
+        collect_scoring_terms(*plan, terms);
+        std::vector<TermScorer> scorers;
+        for (const auto &[source, e] : terms)
+            scorers.push_back(source->open_scorer(*e, stats.idf(term_key(*source, *e)), stats.avg_doc_length()));
+
+        DocIteratorPtr filter;
+        if (!is_pure_disjunction(*plan) || deleted_count > 0)
+            filter = compile_matches();
+        std::vector<ScoredDoc> top = block_max_wand(scorers, filter.get(), k);
+
+        if (top.size() < k && top.size() < total)
+        {
+            std::vector<uint32_t> scored;
+            for (const ScoredDoc &d : top)
+                scored.push_back(d.doc);
+            std::sort(scored.begin(), scored.end());
+            for (DocIteratorPtr it = compile_matches(); !it->at_end() && top.size() < k; it->next())
+                if (!std::binary_search(scored.begin(), scored.end(), it->doc()))
+                    top.push_back({it->doc(), 0});
+        }
+        return top;
     }
 
     struct PrintResult
@@ -386,30 +1174,529 @@ public:
 
     PrintResult get_doc_details(uint32_t doc_id)
     {
-        if (doc_id >= doc_offsets.size())
+        if (doc_id >= total_docs)
             return {"", ""};
 
-        docs_in.seekg(doc_offsets[doc_id]);
+        // A record that does not fit in docs.bin is shown empty.
+        uint64_t off;
+        memcpy(&off, doc_offsets + (uint64_t)doc_id * 8, 8);
+        uint64_t size = docs_map.size();
+        if (off > size || size - off < 2)
+            return {"", ""};
+        const char *p = docs_map.data() + off;
 
         uint16_t u_len;
-        docs_in.read((char *)&u_len, 2);
-        std::string url(u_len, ' ');
-        docs_in.read(&url[0], u_len);
+        memcpy(&u_len, p, 2);
+        if (size - off < 2 + (uint64_t)u_len + 2)
+            return {"", ""};
+        std::string url(p + 2, u_len);
+        p += 2 + u_len;
 
         uint16_t t_len;
-        docs_in.read((char *)&t_len, 2);
-        std::string title(t_len, ' ');
-        docs_in.read(&title[0], t_len);
+        memcpy(&t_len, p, 2);
+        if (size - off < 2 + (uint64_t)u_len + 2 + t_len)
+            return {"", ""};
+        std::string title(p + 2, t_len);
 
         return {url, title};
     }
 };
 
+// All shards or segments listed in DATA_DIR/manifest.txt
+// (shard_manifest.h), or just the index in DATA_DIR when there is no
+// manifest. Every query is sent to all shards at once on the shared pool;
+// shard doc ids become global by adding the shard's doc base. Shards are in
+// doc base order, so boolean results are merged by concatenation. Ranked
+// results are merged by score; all shards score with the BM25 statistics
+// of the whole set (RankingStats). A ShardSet never changes once loaded.
+class ShardSet
+{
+private:
+    ThreadPool &pool;
+    std::vector<ShardInfo> shards;
+    std::vector<std::unique_ptr<SearchEngine>> engines;
+
+    size_t shard_of(uint32_t doc) const
+    {
+        auto it = std::upper_bound(shards.begin(), shards.end(), doc, [](uint32_t d, const ShardInfo &s)
+                                   { return d < s.doc_base; });
+        return it == shards.begin() ? 0 : it - shards.begin() - 1;
+    }
+
+public:
+    // Throws std::runtime_error if the manifest or an index cannot be
+    // loaded.
+    explicit ShardSet(ThreadPool &p) : pool(p)
+    {
+        std::ifstream probe(DATA_DIR + MANIFEST_NAME);
+        if (!probe)
+        {
+            engines.push_back(std::make_unique<SearchEngine>(DATA_DIR, pool));
+            shards.push_back({0, engines[0]->num_docs(), "."});
+            return;
+        }
+        if (!read_manifest(DATA_DIR + MANIFEST_NAME, shards))
+        {
+            throw std::runtime_error(DATA_DIR + MANIFEST_NAME + " is malformed.");
+        }
+        for (const ShardInfo &s : shards)
+        {
+            engines.push_back(std::make_unique<SearchEngine>(DATA_DIR + s.dir + "/", pool));
+            if (engines.back()->num_docs() != s.num_docs)
+            {
+                throw std::runtime_error("shard " + s.dir + " does not match the manifest. Rebuild it with Lab 6.");
+            }
+        }
+    }
+
+    size_t num_shards() const
+    {
+        return shards.size();
+    }
+
+    uint64_t num_deleted() const
+    {
+        uint64_t total = 0;
+        for (const auto &e : engines)
+            total += e->num_deleted();
+        return total;
+    }
+
+    // Cache counters summed over all shards.
+    DocListCache::Stats result_cache_stats() const
+    {
+        DocListCache::Stats total;
+        for (const auto &e : engines)
+            total += e->result_cache_stats();
+        return total;
+    }
+
+    DocListCache::Stats postings_cache_stats() const
+    {
+        DocListCache::Stats total;
+        for (const auto &e : engines)
+            total += e->postings_cache_stats();
+        return total;
+    }
+
+    // The first `n` matches over all shards and their total, estimated if
+    // any shard's is.
+    SearchEngine::ResultPage execute_page(const std::string &query, size_t n) const
+    {
+        std::vector<SearchEngine::ResultPage> parts(shards.size());
+        pool.parallel_for(shards.size(), [&](size_t s)
+                          { parts[s] = engines[s]->execute_page(query, n); });
+        if (shards.size() == 1)
+            return std::move(parts[0]);
+
+        SearchEngine::ResultPage page;
+        for (size_t s = 0; s < shards.size(); ++s)
+        {
+            page.total += parts[s].total;
+            page.estimated = page.estimated || parts[s].estimated;
+            for (size_t i = 0; i < parts[s].docs.size() && page.docs.size() < n; ++i)
+                page.docs.push_back(shards[s].doc_base + parts[s].docs[i]);
+        }
+        return page;
+    }
+
+    DocListCache::List execute_query(const std::string &query) const
+    {
+        std::vector<DocListCache::List> parts(shards.size());
+        pool.parallel_for(shards.size(), [&](size_t s)
+                          { parts[s] = engines[s]->execute_query(query); });
+        if (shards.size() == 1)
+            return parts[0];
+
+        size_t total = 0;
+        for (const auto &part : parts)
+            total += part->size();
+        auto results = std::make_shared<std::vector<uint32_t>>();
+        results->reserve(total);
+        for (size_t s = 0; s < shards.size(); ++s)
+            for (uint32_t doc : *parts[s])
+                results->push_back(shards[s].doc_base + doc);
+        return results;
+    }
+
+    std::vector<ScoredDoc> execute_ranked(const std::string &query, size_t k, uint64_t &total, bool &estimated) const
+    {
+        std::vector<RankingStats> shard_stats(shards.size());
+        pool.parallel_for(shards.size(), [&](size_t s)
+                          { engines[s]->add_ranking_stats(query, shard_stats[s]); });
+        RankingStats stats;
+        for (const RankingStats &part : shard_stats)
+            stats += part;
+
+        std::vector<std::vector<ScoredDoc>> parts(shards.size());
+        std::vector<uint64_t> counts(shards.size());
+        std::vector<char> estimates(shards.size());
+        auto run_shard = [&](size_t s)
+        {
+            bool shard_estimated;
+            parts[s] = engines[s]->execute_ranked(query, k, stats, counts[s], shard_estimated);
+            estimates[s] = shard_estimated;
+        };
+        pool.parallel_for(shards.size(), run_shard);
+
+        total = 0;
+        estimated = std::find(estimates.begin(), estimates.end(), 1) != estimates.end();
+        std::vector<ScoredDoc> merged;
+        for (size_t s = 0; s < shards.size(); ++s)
+        {
+            total += counts[s];
+            for (const ScoredDoc &d : parts[s])
+                merged.push_back({shards[s].doc_base + d.doc, d.score});
+        }
+        std::sort(merged.begin(), merged.end(), [](const ScoredDoc &a, const ScoredDoc &b)
+                  { return a.score > b.score || (a.score == b.score && a.doc < b.doc); });
+        if (merged.size() > k)
+            merged.resize(k);
+        return merged;
+    }
+
+    SearchEngine::PrintResult get_doc_details(uint32_t doc) const
+    {
+        size_t s = shard_of(doc);
+        return engines[s]->get_doc_details(doc - shards[s].doc_base);
+    }
+};
+
+// Holds the current ShardSet. A query takes a snapshot and uses it for the
+// matching and for the result lines, so reload() can swap in new segments
+// and tombstones while queries run; the old set is freed after its last
+// query.
+class ShardedSearcher
+{
+private:
+    ThreadPool pool;
+    std::mutex mtx;
+    std::shared_ptr<const ShardSet> current;
+
+public:
+    // `threads` is how many threads one query may use, the caller included.
+    explicit ShardedSearcher(size_t threads) : pool(threads > 1 ? threads - 1 : 0)
+    {
+        try
+        {
+            current = std::make_shared<const ShardSet>(pool);
+        }
+        catch (const std::runtime_error &e)
+        {
+            std::cerr << "CRITICAL ERROR: " << e.what() << "\n";
+            exit(1);
+        }
+    }
+
+    std::shared_ptr<const ShardSet> snapshot()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return current;
+    }
+
+    // Re-reads the manifest and tombstones (after indexer --append, --delete
+    // or --merge).
+    // False, with the reason in `error`, if the new set cannot be loaded
+    // (say, the indexer is replacing segments right now); the current set
+    // stays in use then.
+    bool reload(std::string &error)
+    {
+        std::shared_ptr<const ShardSet> fresh;
+        try
+        {
+            fresh = std::make_shared<const ShardSet>(pool);
+        }
+        catch (const std::runtime_error &e)
+        {
+            error = e.what();
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        current = std::move(fresh);
+        return true;
+    }
+};
+
+class LatencyStats
+{
+private:
+    std::mutex mtx;
+    std::vector<double> samples;
+    size_t next_slot = 0;
+    uint64_t total_queries = 0;
+
+public:
+    void add(double ms)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (samples.size() < LATENCY_WINDOW)
+            samples.push_back(ms);
+        else
+            samples[next_slot] = ms;
+        next_slot = (next_slot + 1) % LATENCY_WINDOW;
+        total_queries++;
+    }
+
+    void report(std::ostream &out)
+    {
+        std::vector<double> sorted;
+        uint64_t total;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            sorted = samples;
+            total = total_queries;
+        }
+        std::sort(sorted.begin(), sorted.end());
+
+        auto percentile = [&](double p) -> double
+        {
+            if (sorted.empty())
+                return 0;
+            size_t idx = (size_t)(p * (sorted.size() - 1) + 0.5);
+            return sorted[idx];
+        };
+
+        out << "queries\t" << total << "\n";
+        out << "window\t" << sorted.size() << "\n";
+        out << "p50_ms\t" << percentile(0.50) << "\n";
+        out << "p99_ms\t" << percentile(0.99) << "\n";
+        out << "max_ms\t" << (sorted.empty() ? 0 : sorted.back()) << "\n";
+    }
+};
+
+double write_web_response(std::ostream &out, ShardedSearcher &engine, const std::string &query, uint64_t offset,
+                          uint64_t limit)
+{
+    auto view = engine.snapshot();
+    auto start = std::chrono::high_resolution_clock::now();
+    auto page = view->execute_page(query, offset + limit);
+    auto end = std::chrono::high_resolution_clock::now();
+    double time_ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+    // An estimated count is sent as "~N".
+    out << (page.estimated ? "~" : "") << page.total << "\n";
+    out << time_ms << "\n";
+
+    for (uint64_t i = offset; i < page.docs.size(); ++i)
+    {
+        auto doc = view->get_doc_details(page.docs[i]);
+        std::replace(doc.title.begin(), doc.title.end(), '\n', ' ');
+        out << doc.url << "\t" << doc.title << "\n";
+    }
+    return time_ms;
+}
+
+// Same as write_web_response, ranked: each line also carries the score.
+double write_ranked_response(std::ostream &out, ShardedSearcher &engine, const std::string &query, uint64_t offset,
+                             uint64_t limit)
+{
+    auto view = engine.snapshot();
+    auto start = std::chrono::high_resolution_clock::now();
+    uint64_t total;
+    bool estimated;
+    auto results = view->execute_ranked(query, offset + limit, total, estimated);
+    auto end = std::chrono::high_resolution_clock::now();
+    double time_ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+    out << (estimated ? "~" : "") << total << "\n";
+    out << time_ms << "\n";
+
+    for (uint64_t i = offset; i < results.size(); ++i)
+    {
+        auto doc = view->get_doc_details(results[i].doc);
+        std::replace(doc.title.begin(), doc.title.end(), '\n', ' ');
+        out << doc.url << "\t" << doc.title << "\t" << results[i].score << "\n";
+    }
+    return time_ms;
+}
+
+class SearchServer
+{
+private:
+    ShardedSearcher &engine;
+    LatencyStats latency;
+    int port;
+    std::atomic<int> active_clients{0};
+
+public:
+    SearchServer(ShardedSearcher &e, int p) : engine(e), port(p) {}
+
+    int run()
+    {
+        signal(SIGPIPE, SIG_IGN);
+
+        int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd < 0)
+        {
+            perror("socket");
+            return 1;
+        }
+
+        int yes = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 64) < 0)
+        {
+            perror("bind/listen");
+            close(listen_fd);
+            return 1;
+        }
+
+        std::cout << "Searcher daemon listening on 127.0.0.1:" << port << std::endl;
+
+        while (true)
+        {
+            int client_fd = accept(listen_fd, nullptr, nullptr);
+            if (client_fd < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                perror("accept");
+                break;
+            }
+            if (active_clients >= MAX_CLIENTS)
+            {
+                send_all(client_fd, "ERROR\tserver busy\n\n");
+                close(client_fd);
+                continue;
+            }
+            timeval idle{CLIENT_IDLE_SECONDS, 0};
+            setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+            active_clients++;
+            std::thread(&SearchServer::serve_client, this, client_fd).detach();
+        }
+
+        close(listen_fd);
+        return 0;
+    }
+
+private:
+    static bool send_all(int fd, const std::string &data)
+    {
+        size_t sent = 0;
+        while (sent < data.size())
+        {
+            ssize_t n = send(fd, data.data() + sent, data.size() - sent, 0);
+            if (n <= 0)
+                return false;
+            sent += n;
+        }
+        return true;
+    }
+
+    void serve_client(int fd)
+    {
+        serve_requests(fd);
+        close(fd);
+        active_clients--;
+    }
+
+    void serve_requests(int fd)
+    {
+        std::string pending;
+        char buf[4096];
+
+        while (true)
+        {
+            size_t nl;
+            while ((nl = pending.find('\n')) != std::string::npos)
+            {
+                std::string line = pending.substr(0, nl);
+                pending.erase(0, nl + 1);
+                if (!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                if (line.empty())
+                    continue;
+                if (!send_all(fd, handle_request(line)))
+                    return;
+            }
+
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if (n <= 0)
+                return;
+            pending.append(buf, n);
+        }
+    }
+
+    // Request lines:
+    //   SEARCH<TAB>offset<TAB>limit<TAB>query  -> same body as --web
+    //   RANKED<TAB>offset<TAB>limit<TAB>query  -> same body as --ranked
+    //   STATS                                  -> key<TAB>value lines
+    //   RELOAD                                 -> STATS after re-reading the manifest,
+    //                                             ERROR if it could not be loaded
+    // STATS includes the result and postings cache counters, summed over
+    // the shards; RELOAD starts the caches afresh.
+    // Every response is terminated by an empty line.
+    std::string handle_request(const std::string &line)
+    {
+        std::ostringstream out;
+
+        std::string error;
+        if (line == "RELOAD" && !engine.reload(error))
+        {
+            out << "ERROR\treload failed, still serving the previous index: " << error << "\n";
+        }
+        else if (line == "STATS" || line == "RELOAD")
+        {
+            auto view = engine.snapshot();
+            latency.report(out);
+            out << "shards\t" << view->num_shards() << "\n";
+            out << "deleted_docs\t" << view->num_deleted() << "\n";
+            view->result_cache_stats().report(out, "result_cache");
+            view->postings_cache_stats().report(out, "postings_cache");
+        }
+        else if (line.compare(0, 7, "SEARCH\t") == 0 || line.compare(0, 7, "RANKED\t") == 0)
+        {
+            size_t t1 = line.find('\t', 7);
+            size_t t2 = (t1 == std::string::npos) ? t1 : line.find('\t', t1 + 1);
+            if (t2 == std::string::npos)
+            {
+                out << "ERROR\tmalformed " << line.substr(0, 6) << " request\n";
+            }
+            else
+            {
+                uint64_t offset = parse_count(line.substr(7, t1 - 7));
+                uint64_t limit = parse_count(line.substr(t1 + 1, t2 - t1 - 1));
+                std::string query = line.substr(t2 + 1);
+
+                auto start = std::chrono::high_resolution_clock::now();
+                if (line[0] == 'R')
+                    write_ranked_response(out, engine, query, offset, limit);
+                else
+                    write_web_response(out, engine, query, offset, limit);
+                auto end = std::chrono::high_resolution_clock::now();
+                latency.add(std::chrono::duration<double, std::milli>(end - start).count());
+            }
+        }
+        else
+        {
+            out << "ERROR\tunknown command\n";
+        }
+
+        out << "\n";
+        return out.str();
+    }
+};
+
 int main(int argc, char *argv[])
 {
     setlocale(LC_ALL, "");
 
-    SearchEngine engine;
+    // "--threads N" before the mode caps the threads one query may use.
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    if (argc > 2 && std::string(argv[1]) == "--threads")
+    {
+        threads = (size_t)std::max(1, std::stoi(argv[2]));
+        argc -= 2;
+        argv += 2;
+    }
+
+    ShardedSearcher engine(threads);
 
     if (argc > 1 && std::string(argv[1]) == "--cli")
     {
@@ -418,11 +1705,12 @@ int main(int argc, char *argv[])
         {
             if (line.empty())
                 continue;
-            auto results = engine.execute_query(line);
-            std::cout << "Query: " << line << " Found: " << results.size() << "\n";
-            for (size_t i = 0; i < std::min((size_t)5, results.size()); ++i)
+            auto view = engine.snapshot();
+            auto results = view->execute_query(line);
+            std::cout << "Query: " << line << " Found: " << results->size() << "\n";
+            for (size_t i = 0; i < std::min((size_t)5, results->size()); ++i)
             {
-                auto doc = engine.get_doc_details(results[i]);
+                auto doc = view->get_doc_details((*results)[i]);
                 std::cout << "  " << doc.title << " (" << doc.url << ")\n";
             }
             std::cout << "-----------------------\n";
@@ -431,29 +1719,36 @@ int main(int argc, char *argv[])
     else if (argc > 2 && std::string(argv[1]) == "--web")
     {
         std::string query = argv[2];
-        int offset = (argc > 3) ? std::stoi(argv[3]) : 0;
-        int limit = (argc > 4) ? std::stoi(argv[4]) : 50;
-
-        auto start = std::chrono::high_resolution_clock::now();
-        auto results = engine.execute_query(query);
-        auto end = std::chrono::high_resolution_clock::now();
-        double time_ms = std::chrono::duration<double, std::milli>(end - start).count();
+        uint64_t offset = (argc > 3) ? parse_count(argv[3]) : 0;
+        uint64_t limit = (argc > 4) ? parse_count(argv[4]) : 50;
 
-        std::cout << results.size() << "\n";
-        std::cout << time_ms << "\n";
+        write_web_response(std::cout, engine, query, offset, limit);
+    }
+    else if (argc > 2 && std::string(argv[1]) == "--ranked")
+    {
+        std::string query = argv[2];
+        uint64_t offset = (argc > 3) ? parse_count(argv[3]) : 0;
+        uint64_t limit = (argc > 4) ? parse_count(argv[4]) : 50;
 
-        for (int i = offset; i < offset + limit && i < results.size(); ++i)
-        {
-            auto doc = engine.get_doc_details(results[i]);
-            std::replace(doc.title.begin(), doc.title.end(), '\n', ' ');
-            std::cout << doc.url << "\t" << doc.title << "\n";
-        }
+        write_ranked_response(std::cout, engine, query, offset, limit);
+    }
+    else if (argc > 1 && std::string(argv[1]) == "--serve")
+    {
+        int port = (argc > 2) ? std::stoi(argv[2]) : DEFAULT_SERVE_PORT;
+        SearchServer server(engine, port);
+        return server.run();
     }
     else
     {
-        std::cout << "Usage:\n";
+        std::cout << "Usage (any mode may be preceded by --threads N, threads per query):\n";
         std::cout << "  ./searcher --cli < queries.txt\n";
         std::cout << "  ./searcher --web \"query string\" offset limit\n";
+        std::cout << "  ./searcher --ranked \"query string\" offset limit   (BM25 order, score in the 3rd column)\n";
+        std::cout << "  ./searcher --serve [port]\n";
+        std::cout << "Queries: terms with && || ! and parentheses; ~term matches every word form\n";
+        std::cout << "with the same stem (needs index_stem.bin from ./indexer --stem).\n";
+        std::cout << "\"a b c\" matches the phrase, a NEAR/k b terms or phrases at most k positions\n";
+        std::cout << "apart (both need ./indexer --positions, otherwise they run as a && b).\n";
     }
 
     return 0;
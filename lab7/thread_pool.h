@@ -0,0 +1,110 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <atomic>
+
+// Fixed set of worker threads shared by all queries of the process. A
+// parallel_for() caller works on its own items too, so a query never waits
+// for workers that are busy with other queries' items to make progress.
+class ThreadPool
+{
+private:
+    std::vector<std::thread> workers;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> tasks;
+    bool stopping = false;
+
+    struct Batch
+    {
+        size_t n;
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> done{0};
+        std::mutex mtx;
+        std::condition_variable cv;
+    };
+
+public:
+    explicit ThreadPool(size_t threads)
+    {
+        for (size_t i = 0; i < threads; ++i)
+            workers.emplace_back(&ThreadPool::work, this);
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto &w : workers)
+            w.join();
+    }
+
+    // Threads a parallel_for() runs on, the caller included.
+    size_t concurrency() const { return workers.size() + 1; }
+
+    // Calls fn(i) for every i in [0, n), each exactly once, and returns when
+    // all calls are done. Items are handed out one at a time, so uneven
+    // items balance out.
+    void parallel_for(size_t n, const std::function<void(size_t)> &fn)
+    {
+        auto batch = std::make_shared<Batch>();
+        batch->n = n;
+
+        // A helper that starts after the last item was taken returns
+        // without touching fn, which may be gone by then.
+        auto run = [batch, &fn]()
+        {
+            for (size_t i; (i = batch->next++) < batch->n;)
+            {
+                fn(i);
+                if (++batch->done == batch->n)
+                {
+                    std::lock_guard<std::mutex> lock(batch->mtx);
+                    batch->cv.notify_all();
+                }
+            }
+        };
+
+        size_t helpers = std::min(workers.size(), n > 0 ? n - 1 : 0);
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            for (size_t i = 0; i < helpers; ++i)
+                tasks.push_back(run);
+        }
+        cv.notify_all();
+
+        run();
+        std::unique_lock<std::mutex> lock(batch->mtx);
+        batch->cv.wait(lock, [&batch]()
+                       { return batch->done == batch->n; });
+    }
+
+private:
+    void work()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [this]()
+                        { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+#include "../common/bm25.h"
+#include "../common/frequencies_codec.h"
+#include "doc_iterators.h"
+
+// Top-k BM25 retrieval with Block-Max WAND (Ding & Suel, 2011). Each query
+// term has an upper bound on its score over the whole list and over every
+// block of 128 docs (frequencies_codec.h). Docs whose bounds cannot beat the
+// k-th best score so far are skipped without decoding their tfs, and whole
+// blocks are skipped when their bounds are too low.
+
+struct ScoredDoc
+{
+    uint32_t doc;
+    double score;
+};
+
+class TermScorer
+{
+private:
+    FreqCursor cursor;
+    double idf;
+    const uint32_t *doc_lengths;
+    double avg_doc_length;
+    double bound; // idf times the factor the stored bounds are scaled by
+
+public:
+    // The stored bounds were computed with the index's own average doc
+    // length. Scoring with a larger `avgdl` raises any weight by at most
+    // avgdl / index_avgdl (bm25.h), so the bounds are scaled by that.
+    TermScorer(FreqCursor c, double term_idf, const uint32_t *lengths, double avgdl, double index_avgdl)
+        : cursor(c), idf(term_idf), doc_lengths(lengths), avg_doc_length(avgdl),
+          bound(term_idf * std::max(1.0, avgdl / index_avgdl)) {}
+
+    bool at_end() const { return cursor.at_end(); }
+    uint32_t doc() const { return cursor.doc(); }
+    void next() { cursor.next(); }
+    void advance(uint32_t target) { cursor.advance(target); }
+
+    double score()
+    {
+        return idf * bm25_tf_weight(cursor.tf(), doc_lengths[cursor.doc()], avg_doc_length);
+    }
+
+    double max_score() const { return bound * cursor.max_weight(); }
+
+    // Bound over the block holding `target`, and the last doc of that block.
+    // A list with no doc >= target left is bounded by 0 and has no block.
+    double block_max_score(uint32_t target)
+    {
+        if (!cursor.shallow_advance(target))
+            return 0;
+        return bound * cursor.shallow_max_weight();
+    }
+    bool block_past_end() const { return cursor.shallow_past_end(); }
+    uint32_t block_last_doc() const { return cursor.shallow_last_doc(); }
+};
+
+// The k best docs seen so far, the worst on top. Of equal scores the lower
+// doc id wins, so the result does not depend on the pruning.
+class TopKHeap
+{
+private:
+    size_t k;
+    std::vector<ScoredDoc> heap;
+
+    static bool better(const ScoredDoc &a, const ScoredDoc &b)
+    {
+        return a.score > b.score || (a.score == b.score && a.doc < b.doc);
+    }
+
+public:
+    explicit TopKHeap(size_t top_k) : k(top_k) { heap.reserve(k); }
+
+    bool full() const { return heap.size() >= k; }
+
+    // Docs come in ascending id order, so a later doc must score strictly
+    // more than the k-th to get in.
+    double threshold() const { return full() && k > 0 ? heap.front().score : -1.0; }
+
+    void push(uint32_t doc, double score)
+    {
+        if (k == 0 || (full() && score <= heap.front().score))
+            return;
+        if (full())
+        {
+            std::pop_heap(heap.begin(), heap.end(), better);
+            heap.pop_back();
+        }
+        heap.push_back({doc, score});
+        std::push_heap(heap.begin(), heap.end(), better);
+    }
+
+    std::vector<ScoredDoc> sorted()
+    {
+        std::vector<ScoredDoc> out = heap;
+        std::sort(out.begin(), out.end(), better);
+        return out;
+    }
+};
+
+// Top k docs by the summed score of `scorers`, best first. With a `filter`,
+// only docs it yields are scored, so a boolean query can be ranked without
+// enumerating all of its matches.
+inline std::vector<ScoredDoc> block_max_wand(std::vector<TermScorer> &scorers, DocIterator *filter, size_t k)
+{
+    TopKHeap top(k);
+    std::vector<TermScorer *> live;
+    for (auto &s : scorers)
+        if (!s.at_end())
+            live.push_back(&s);
+
+    while (!live.empty())
+    {
+        std::sort(live.begin(), live.end(), [](const TermScorer *a, const TermScorer *b)
+                  { return a->doc() < b->doc(); });
+
+        // Pivot: the first doc where the terms up to it could beat the
+        // threshold. Every cursor already on that doc joins the pivot set.
+        double threshold = top.threshold();
+        double bound = 0;
+        size_t p = 0;
+        while (p < live.size())
+        {
+            bound += live[p]->max_score();
+            if (bound > threshold)
+                break;
+            p++;
+        }
+        if (p == live.size())
+            break;
+        uint32_t pivot = live[p]->doc();
+        while (p + 1 < live.size() && live[p + 1]->doc() == pivot)
+            p++;
+
+        double block_bound = 0;
+        for (size_t i = 0; i <= p; ++i)
+            block_bound += live[i]->block_max_score(pivot);
+
+        if (block_bound > threshold)
+        {
+            uint32_t target = pivot;
+            if (live[0]->doc() == pivot && filter)
+            {
+                filter->advance(pivot);
+                if (filter->at_end())
+                    break;
+                target = filter->doc();
+            }
+
+            if (live[0]->doc() == target)
+            {
+                double score = 0;
+                for (size_t i = 0; i <= p; ++i)
+                    score += live[i]->score();
+                top.push(pivot, score);
+                for (size_t i = 0; i <= p; ++i)
+                    live[i]->next();
+            }
+            else
+            {
+                for (size_t i = 0; i <= p && live[i]->doc() < target; ++i)
+                    live[i]->advance(target);
+            }
+        }
+        else
+        {
+            // No doc before the end of the shortest pivot block can make it,
+            // unless a term past the pivot set joins in.
+            // Lists without a block at the pivot end before it.
+            uint32_t next_doc = UINT32_MAX;
+            for (size_t i = 0; i <= p; ++i)
+                if (!live[i]->block_past_end())
+                    next_doc = std::min(next_doc, live[i]->block_last_doc() + 1);
+            if (p + 1 < live.size())
+                next_doc = std::min(next_doc, live[p + 1]->doc());
+            for (size_t i = 0; i <= p; ++i)
+                live[i]->advance(next_doc);
+        }
+
+        live.erase(std::remove_if(live.begin(), live.end(), [](const TermScorer *s)
+                                  { return s->at_end(); }),
+                   live.end());
+    }
+    return top.sorted();
+}